@@ -0,0 +1,2 @@
+/* Stand-in for the kernel header, see wii-kcompat.h */
+#include "../wii-kcompat.h"
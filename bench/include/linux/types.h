@@ -0,0 +1,8 @@
+/* Stand-in for the kernel's <linux/types.h>: the uapi types, then the rest */
+#ifndef WII_BENCH_LINUX_TYPES_H
+#define WII_BENCH_LINUX_TYPES_H
+
+#include_next <linux/types.h>
+#include "../wii-kcompat.h"
+
+#endif
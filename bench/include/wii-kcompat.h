@@ -0,0 +1,144 @@
+/*
+ * wii-kcompat.h - just enough of the kernel API to build circularbuffer.c and
+ * wii-remote-decode.c in user space for the benchmark.
+ *
+ * The headers next to this one stand in for the kernel headers those files
+ * include and all come down to this one. Memory ordering matches the kernel
+ * primitives; sleeping and mapping are not supported, the benchmark polls.
+ */
+
+#ifndef WII_KCOMPAT_H
+#define WII_KCOMPAT_H
+
+#include <linux/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+typedef __u8  u8;
+typedef __u16 u16;
+typedef __u32 u32;
+typedef __u64 u64;
+typedef __s8  s8;
+typedef __s16 s16;
+typedef __s32 s32;
+typedef __s64 s64;
+
+#define __user
+#define __rcu
+#define __percpu
+
+#define U64_MAX UINT64_MAX
+#define S16_MIN INT16_MIN
+#define S16_MAX INT16_MAX
+
+/* IS_ENABLED() as in <linux/kconfig.h>, for options defined to 1 */
+#define __ARG_PLACEHOLDER_1 0,
+#define __take_second_arg(__ignored, val, ...) val
+#define ____is_defined(arg1_or_junk) __take_second_arg(arg1_or_junk 1, 0)
+#define ___is_defined(val) ____is_defined(__ARG_PLACEHOLDER_##val)
+#define __is_defined(x) ___is_defined(x)
+#define IS_ENABLED(option) __is_defined(option)
+
+#define KERN_ERR     ""
+#define KERN_WARNING ""
+#define KERN_INFO    ""
+#define printk(...) fprintf(stderr, __VA_ARGS__)
+#define printk_ratelimited(...) printk(__VA_ARGS__)
+
+#define BUILD_BUG_ON(cond) _Static_assert(!(cond), #cond)
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define min(a, b) ({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a < _b ? _a : _b; })
+#define max(a, b) ({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a > _b ? _a : _b; })
+#define min_t(type, a, b) min((type)(a), (type)(b))
+#define max_t(type, a, b) max((type)(a), (type)(b))
+#define clamp(val, lo, hi) min(max(val, lo), hi)
+#define clamp_t(type, val, lo, hi) min_t(type, max_t(type, val, lo), hi)
+#define roundup(x, y) ((((x) + (y) - 1) / (y)) * (y))
+#define rounddown(x, y) ((x) - ((x) % (y)))
+#define is_power_of_2(n) ((n) != 0 && (((n) & ((n) - 1)) == 0))
+
+static inline unsigned long int_sqrt(unsigned long x)
+{
+    unsigned long b, m, y = 0;
+
+    if (x <= 1)
+        return x;
+    for (m = 1UL << ((sizeof(x) * 8 - 2) & ~1UL); m; m >>= 2) {
+        b = y + m;
+        y >>= 1;
+        if (x >= b) {
+            x -= b;
+            y += m;
+        }
+    }
+    return y;
+}
+
+#define READ_ONCE(x) (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, val) (*(volatile __typeof__(x) *)&(x) = (val))
+#define smp_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define cmpxchg(p, old, new) __sync_val_compare_and_swap(p, old, new)
+
+#define PAGE_SIZE 4096UL
+#define PAGE_ALIGN(x) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+#define MAX_ERRNO 4095
+
+static inline void *ERR_PTR(long error)
+{
+    return (void *)error;
+}
+
+static inline long PTR_ERR(const void *ptr)
+{
+    return (long)ptr;
+}
+
+static inline bool IS_ERR(const void *ptr)
+{
+    return (unsigned long)ptr >= (unsigned long)-MAX_ERRNO;
+}
+
+#define GFP_KERNEL 0
+#define kzalloc(size, gfp) calloc(1, size)
+#define kfree(ptr) free(ptr)
+
+static inline void *vmalloc_user(unsigned long size)
+{
+    void *p = aligned_alloc(PAGE_SIZE, PAGE_ALIGN(size));
+
+    if (p)
+        memset(p, 0, PAGE_ALIGN(size));
+    return p;
+}
+
+#define vfree(ptr) free(ptr)
+
+/* Nobody sleeps on a ring in user space */
+typedef struct {
+    int unused;
+} wait_queue_head_t;
+
+#define EPOLLIN     0x00000001
+#define EPOLLRDNORM 0x00000040
+#define wq_has_sleeper(wq) false
+#define wake_up_interruptible_poll(wq, mask) do { } while (0)
+
+struct vm_area_struct {
+    unsigned long vm_pgoff;
+};
+
+static inline int remap_vmalloc_range(struct vm_area_struct *vma, void *addr,
+                                      unsigned long pgoff)
+{
+    return -ENOSYS;
+}
+
+#endif /* WII_KCOMPAT_H */
@@ -0,0 +1,372 @@
+/*
+ * wii-bench.c - replay input reports through the driver's decoder and ring.
+ *
+ * Builds wii-remote-decode.c and circularbuffer.c as they are, on top of
+ * bench/include/, and runs them the way the driver does: the main thread
+ * plays the HID callback and decoder (decode, optionally derive, write one
+ * struct wii_event per report), a second thread plays a reader draining the
+ * ring. Reports come from a capture of struct wii_raw_report records, as read
+ * from the driver's debugfs capture file (WIIMOTE_IOCTL_SET_CAPTURE) or from a
+ * file switched to WII_FORMAT_RAW, or from a built-in synthetic stream.
+ *
+ * Reports decode cost per report, enqueue cost per event, how many events the
+ * ring dropped, and the percentiles of the time from decode to read. Drop and
+ * latency figures only mean something with a CPU for each thread or with a
+ * replay rate (-r) the machine can keep up with.
+ *
+ *   make bench
+ *   bench/wii-bench -r 100 -n 10000 -p 10000 capture.raw
+ */
+
+#include <linux/types.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "circularbuffer.h"
+#include "wii-remote-decode.h"
+
+/* What the driver uses until the remote's own calibration has been read */
+#define BENCH_ACCEL_ZERO    0x200
+#define BENCH_ACCEL_ONE_G   0x268
+
+#define BENCH_SYNTHETIC_REPORTS 1000
+
+struct bench_reader {
+    struct circ_buffer *ring;
+    unsigned int poll_us;           /* sleep between drains, 0 to spin */
+    int done;                       /* set by the producer once it stopped */
+    u64 *latency_ns;                /* one sample per event read */
+    size_t samples, max_samples;
+    unsigned long records;
+};
+
+static u64 now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(u64 deadline_ns)
+{
+    struct timespec ts = {
+        .tv_sec = deadline_ns / 1000000000ULL,
+        .tv_nsec = deadline_ns % 1000000000ULL,
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+/* Mean cost of one now_ns() call, taken off every timed section */
+static u64 timer_overhead_ns(void)
+{
+    u64 start = now_ns();
+    int i;
+
+    for (i = 0; i < 1000; i++)
+        now_ns();
+    return (now_ns() - start) / 1001;
+}
+
+/*
+ * Drain the ring the way wii_reader_copy() does: whole records, at most two
+ * contiguous copies, redone if the producer overwrote them meanwhile.
+ */
+static size_t bench_drain(struct bench_reader *reader, char *buf, size_t len)
+{
+    struct circ_buffer *ring = reader->ring;
+    unsigned int tail, pos;
+    const char *src;
+    size_t copied, chunk, i;
+    struct wii_event ev;
+    u64 now;
+    int pass;
+
+    len = rounddown(len, ring->record_size);
+    do {
+        tail = circ_buffer_read_begin(ring);
+        pos = tail;
+        copied = 0;
+        for (pass = 0; pass < 2 && copied < len; pass++) {
+            chunk = min(circ_buffer_peek(ring, pos, &src), len - copied);
+            if (!chunk)
+                break;
+            memcpy(buf + copied, src, chunk);
+            pos += chunk;
+            copied += chunk;
+        }
+        copied = rounddown(copied, ring->record_size);
+        pos = tail + copied;
+        if (!copied)
+            return 0;
+    } while (!circ_buffer_read_commit(ring, tail, pos));
+
+    now = now_ns();
+    for (i = 0; i < copied; i += sizeof(ev)) {
+        memcpy(&ev, buf + i, sizeof(ev));
+        if (reader->samples < reader->max_samples)
+            reader->latency_ns[reader->samples++] = now - ev.timestamp_ns;
+    }
+    reader->records += copied / sizeof(ev);
+    return copied;
+}
+
+static void *bench_reader_thread(void *arg)
+{
+    struct bench_reader *reader = arg;
+    struct timespec pause;
+    char buf[64 * sizeof(struct wii_event)];
+    bool done;
+
+    pause.tv_sec = reader->poll_us / 1000000;
+    pause.tv_nsec = (reader->poll_us % 1000000) * 1000L;
+
+    for (;;) {
+        /* Read before draining, so nothing written before the flag is missed */
+        done = __atomic_load_n(&reader->done, __ATOMIC_ACQUIRE);
+        while (bench_drain(reader, buf, sizeof(buf)))
+            ;
+        if (done)
+            return NULL;
+        if (reader->poll_us)
+            nanosleep(&pause, NULL);
+    }
+}
+
+/* A 0x37 stream (buttons, accelerometer, basic IR, extension) with some motion */
+static struct wii_raw_report *bench_synthetic(size_t *count)
+{
+    struct wii_raw_report *cap;
+    size_t i;
+    u8 *d;
+
+    cap = calloc(BENCH_SYNTHETIC_REPORTS, sizeof(*cap));
+    if (!cap)
+        return NULL;
+    for (i = 0; i < BENCH_SYNTHETIC_REPORTS; i++) {
+        d = cap[i].data;
+        cap[i].len = WII_RAW_MAX_LEN;
+        d[0] = 0x37;
+        d[2] = (i / 50) & 1 ? 0x08 : 0x00;          /* A pressed every other 50 */
+        d[3] = 0x80 + (i % 32);
+        d[4] = 0x80 - (i % 16);
+        d[5] = 0x9a;
+        /* Two dots drifting across the camera, two untracked */
+        d[6] = i % 256;
+        d[7] = 0x40;
+        d[8] = 0x00;
+        d[9] = (i + 100) % 256;
+        d[10] = 0x40;
+        memset(&d[11], 0xff, 5);
+        d[16] = 0x80;
+        d[17] = 0x80;
+    }
+    *count = BENCH_SYNTHETIC_REPORTS;
+    return cap;
+}
+
+static struct wii_raw_report *bench_load(const char *path, size_t *count)
+{
+    struct wii_raw_report *cap;
+    long size;
+    size_t i;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    if (fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET)) {
+        perror(path);
+        fclose(f);
+        return NULL;
+    }
+    *count = size / sizeof(*cap);
+    if (!*count || size % sizeof(*cap)) {
+        fprintf(stderr, "%s: not a whole number of struct wii_raw_report records\n", path);
+        fclose(f);
+        return NULL;
+    }
+    cap = malloc(size);
+    if (!cap || fread(cap, sizeof(*cap), *count, f) != *count) {
+        fprintf(stderr, "%s: read failed\n", path);
+        free(cap);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+
+    for (i = 0; i < *count; i++) {
+        if (cap[i].len > WII_RAW_MAX_LEN) {
+            fprintf(stderr, "%s: record %zu has a bad length\n", path, i);
+            free(cap);
+            return NULL;
+        }
+    }
+    return cap;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const u64 *sorted, size_t n, double p)
+{
+    size_t i = (size_t)(p / 100.0 * (n - 1) + 0.5);
+
+    return sorted[i] / 1000.0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-r rate] [-n reports] [-s ring_size] [-p poll_us] [-d] [-o] [capture]\n"
+            "  -r  reports per second, 0 for as fast as possible (default: 0)\n"
+            "  -n  reports to replay, looping over the capture (default: 1000000)\n"
+            "  -s  ring size in bytes, a power of two (default: %u)\n"
+            "  -p  reader sleep between drains in us, 0 to spin (default: 0)\n"
+            "  -d  fill in derived data, like derived_data=1\n"
+            "  -o  overwrite the oldest records when full instead of dropping new ones\n"
+            "  capture is a file of struct wii_raw_report records; without one a\n"
+            "  synthetic 0x37 stream is replayed\n",
+            prog, CIRC_BUFFER_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+    struct wii_calibration calib = { .source = WII_CALIB_NOMINAL };
+    struct wii_decode_state state = { 0 };
+    struct bench_reader reader = { 0 };
+    unsigned long reports = 1000000, rate = 0, ring_size = CIRC_BUFFER_SIZE;
+    unsigned long events = 0, i;
+    bool derive = false, overwrite = false;
+    u64 decode_ns = 0, enqueue_ns = 0, overhead, start, end, t0, t1, t2;
+    struct wii_raw_report *cap;
+    const struct wii_raw_report *raw;
+    struct wii_event ev;
+    pthread_t thread;
+    size_t ncap;
+    double secs;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:n:s:p:doh")) != -1) {
+        switch (opt) {
+        case 'r':
+            rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            reports = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            ring_size = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            reader.poll_us = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            derive = true;
+            break;
+        case 'o':
+            overwrite = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (optind + 1 < argc || !reports) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    cap = optind < argc ? bench_load(argv[optind], &ncap) : bench_synthetic(&ncap);
+    if (!cap)
+        return 1;
+
+    reader.ring = circ_buffer_create(ring_size, sizeof(struct wii_event), NULL);
+    if (IS_ERR(reader.ring)) {
+        fprintf(stderr, "bad ring size %lu\n", ring_size);
+        return 2;
+    }
+    circ_buffer_set_overwrite(reader.ring, overwrite);
+    reader.max_samples = reports;
+    reader.latency_ns = malloc(reports * sizeof(*reader.latency_ns));
+    if (!reader.latency_ns) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < 3; i++) {
+        calib.zero[i] = BENCH_ACCEL_ZERO;
+        calib.one_g[i] = BENCH_ACCEL_ONE_G;
+    }
+
+    overhead = timer_overhead_ns();
+    if (pthread_create(&thread, NULL, bench_reader_thread, &reader)) {
+        fprintf(stderr, "cannot start the reader thread\n");
+        return 1;
+    }
+
+    start = now_ns();
+    for (i = 0; i < reports; i++) {
+        raw = &cap[i % ncap];
+        if (rate)
+            sleep_until(start + i * 1000000000ULL / rate);
+
+        t0 = now_ns();
+        memset(&ev, 0, sizeof(ev));
+        ev.timestamp_ns = t0;
+        if (!wii_decode_report(&state, raw->data, raw->len, &ev)) {
+            decode_ns += now_ns() - t0;
+            continue;
+        }
+        if (derive)
+            wii_derive_event(&calib, &ev);
+        t1 = now_ns();
+        circ_buffer_write(reader.ring, (const char *)&ev, sizeof(ev));
+        t2 = now_ns();
+
+        decode_ns += t1 - t0;
+        enqueue_ns += t2 - t1;
+        events++;
+    }
+    end = now_ns();
+
+    __atomic_store_n(&reader.done, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+
+    secs = (end - start) / 1e9;
+    printf("replayed:   %lu reports (%zu in the capture) in %.3f s, %.0f/s\n",
+           reports, ncap, secs, reports / secs);
+    printf("decode:     %.1f ns/report%s\n",
+           (double)decode_ns / reports - overhead, derive ? " with derived data" : "");
+    if (events)
+        printf("enqueue:    %.1f ns/event\n", (double)enqueue_ns / events - overhead);
+    printf("events:     %lu queued, %lu dropped (%.2f%%), %lu overwritten, %lu read\n",
+           reader.ring->stats.enqueued, reader.ring->stats.dropped,
+           events ? 100.0 * reader.ring->stats.dropped / events : 0.0,
+           reader.ring->stats.overwritten, reader.records);
+    printf("ring:       %u bytes, %u high water\n", reader.ring->size,
+           reader.ring->stats.high_water);
+
+    if (reader.samples) {
+        qsort(reader.latency_ns, reader.samples, sizeof(*reader.latency_ns), cmp_u64);
+        printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+               percentile_us(reader.latency_ns, reader.samples, 50),
+               percentile_us(reader.latency_ns, reader.samples, 90),
+               percentile_us(reader.latency_ns, reader.samples, 99),
+               percentile_us(reader.latency_ns, reader.samples, 99.9),
+               reader.latency_ns[reader.samples - 1] / 1000.0);
+    }
+
+    circ_buffer_destroy(reader.ring);
+    free(reader.latency_ns);
+    free(cap);
+    return 0;
+}
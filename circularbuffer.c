@@ -0,0 +1,181 @@
+/*
+ * circularbuffer.c - lock-free SPSC ring used between the HID receive path and
+ * the character device reader.
+ *
+ * The indices are free running, so head == tail means empty and
+ * head - tail == size means full without giving up a slot. The data written
+ * by the producer is ordered before the release of head, and the consumer's
+ * reads are ordered before its update of tail; the matching acquire loads on
+ * the other side make those bytes visible.
+ *
+ * In overwrite mode both sides move tail with cmpxchg(). The producer only
+ * writes into reclaimed space after its cmpxchg() succeeded, and the consumer
+ * only keeps what it copied if its own cmpxchg() from the same snapshot
+ * succeeded, so a consumer can never return records that were overwritten
+ * while it copied them.
+ *
+ * The header page is writable from user space once the ring is mapped, so the
+ * producer keeps its own copy of head and every index read back from the
+ * header is clamped before it is used to size a copy.
+ */
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/atomic.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+#include <asm/barrier.h>
+
+#include "circularbuffer.h"
+
+struct circ_buffer *circ_buffer_create(unsigned int size, unsigned int record_size,
+                                       wait_queue_head_t *wait)
+{
+    struct circ_buffer *cb;
+
+    BUILD_BUG_ON(sizeof(struct wii_ring_header) > PAGE_SIZE);
+
+    if (!is_power_of_2(size) || record_size > size)
+        return ERR_PTR(-EINVAL);
+
+    cb = kzalloc(sizeof(*cb), GFP_KERNEL);
+    if (!cb)
+        return ERR_PTR(-ENOMEM);
+
+    /* Zeroed and flagged for remap_vmalloc_range(), whatever the size */
+    cb->hdr = vmalloc_user(PAGE_SIZE + PAGE_ALIGN(size));
+    if (!cb->hdr) {
+        kfree(cb);
+        return ERR_PTR(-ENOMEM);
+    }
+
+    cb->data = (char *)cb->hdr + PAGE_SIZE;
+    cb->size = size;
+    cb->record_size = record_size;
+    cb->wait = wait;
+    cb->hdr->version = WII_RING_VERSION;
+    cb->hdr->data_offset = PAGE_SIZE;
+    cb->hdr->size = size;
+    cb->hdr->record_size = record_size;
+    return cb;
+}
+
+void circ_buffer_destroy(struct circ_buffer *cb)
+{
+    if (!cb)
+        return;
+    vfree(cb->hdr);
+    kfree(cb);
+}
+
+int circ_buffer_set_overwrite(struct circ_buffer *cb, bool overwrite)
+{
+    /* Without a fixed record size there is no boundary to reclaim up to */
+    if (overwrite && !cb->record_size)
+        return -EINVAL;
+
+    WRITE_ONCE(cb->hdr->flags, overwrite ? WII_RING_F_OVERWRITE : 0);
+    WRITE_ONCE(cb->overwrite, overwrite);
+    return 0;
+}
+
+int circ_buffer_mmap(struct circ_buffer *cb, struct vm_area_struct *vma)
+{
+    if (vma->vm_pgoff)
+        return -EINVAL;
+
+    /* Rejects mappings larger than the allocation */
+    return remap_vmalloc_range(vma, cb->hdr, 0);
+}
+
+/* Bytes queued between head and tail, trusting neither beyond the ring size */
+static unsigned int circ_buffer_used(struct circ_buffer *cb, unsigned int head,
+                                     unsigned int tail)
+{
+    return min(head - tail, cb->size);
+}
+
+size_t circ_buffer_write(struct circ_buffer *cb, const char *data, size_t len)
+{
+    unsigned int head = cb->head;
+    unsigned int off = head & (cb->size - 1);
+    unsigned int tail, used, reclaim;
+    size_t first;
+
+    for (;;) {
+        tail = smp_load_acquire(&cb->hdr->tail);
+        used = circ_buffer_used(cb, head, tail);
+        if (len <= cb->size - used)
+            break;
+
+        if (!READ_ONCE(cb->overwrite) || len > cb->size) {
+            WRITE_ONCE(cb->stats.dropped, cb->stats.dropped + 1);
+            return 0;
+        }
+
+        /* Reclaim just enough whole records from the consumer's end */
+        reclaim = roundup(len - (cb->size - used), cb->record_size);
+        if (reclaim > used) {
+            /* tail is not on a record boundary; nothing safe to reclaim */
+            WRITE_ONCE(cb->stats.dropped, cb->stats.dropped + 1);
+            return 0;
+        }
+        if (cmpxchg(&cb->hdr->tail, tail, tail + reclaim) == tail)
+            WRITE_ONCE(cb->stats.overwritten,
+                       cb->stats.overwritten + reclaim / cb->record_size);
+        /* else the consumer just freed some space itself; look again */
+    }
+
+    first = min_t(size_t, len, cb->size - off);
+    memcpy(&cb->data[off], data, first);
+    memcpy(&cb->data[0], data + first, len - first);
+
+    /* Publish the bytes before the new head becomes visible to the reader */
+    cb->head = head + len;
+    smp_store_release(&cb->hdr->head, cb->head);
+
+    WRITE_ONCE(cb->stats.enqueued, cb->stats.enqueued + 1);
+    if (used + len > cb->stats.high_water)
+        WRITE_ONCE(cb->stats.high_water, used + len);
+
+    /* wq_has_sleeper() orders the head update against the waiter's check */
+    if (cb->wait && wq_has_sleeper(cb->wait))
+        wake_up_interruptible_poll(cb->wait, EPOLLIN | EPOLLRDNORM);
+    return len;
+}
+
+bool circ_buffer_empty(struct circ_buffer *cb)
+{
+    return smp_load_acquire(&cb->hdr->head) == READ_ONCE(cb->hdr->tail);
+}
+
+/* Bytes the consumer could read right now */
+unsigned int circ_buffer_queued(struct circ_buffer *cb)
+{
+    return circ_buffer_used(cb, smp_load_acquire(&cb->hdr->head), READ_ONCE(cb->hdr->tail));
+}
+
+unsigned int circ_buffer_read_begin(struct circ_buffer *cb)
+{
+    return READ_ONCE(cb->hdr->tail);
+}
+
+size_t circ_buffer_peek(struct circ_buffer *cb, unsigned int pos, const char **ptr)
+{
+    unsigned int head = smp_load_acquire(&cb->hdr->head);
+    unsigned int off = pos & (cb->size - 1);
+
+    *ptr = &cb->data[off];
+    return min(circ_buffer_used(cb, head, pos), cb->size - off);
+}
+
+bool circ_buffer_read_commit(struct circ_buffer *cb, unsigned int tail, unsigned int pos)
+{
+    /* Fully ordered: the reads of the data complete before tail moves */
+    return cmpxchg(&cb->hdr->tail, tail, pos) == tail;
+}
@@ -0,0 +1,93 @@
+/*
+ * circularbuffer.h - single-producer/single-consumer record ring.
+ *
+ * The producer (the HID raw event callback) is the only writer of head and the
+ * consumer (device_read, or a process that mapped the ring) normally the only
+ * writer of tail. Each side publishes its index with a release store and reads
+ * the other side's index with an acquire load, so neither side ever takes a
+ * lock or waits for the other.
+ *
+ * Records are stored whole or not at all. When the ring is full the newest
+ * record is dropped, unless overwrite is set: then the producer reclaims the
+ * oldest records by advancing tail itself with a compare-and-swap, and the
+ * consumer commits its reads with a compare-and-swap too so it can tell that
+ * what it copied was overwritten underneath it.
+ */
+
+#ifndef WII_CIRCULARBUFFER_H
+#define WII_CIRCULARBUFFER_H
+
+#include <linux/types.h>
+#include <linux/wait.h>
+
+#include "wii-remote.h"
+
+struct vm_area_struct;
+
+/* Ring sizes must be powers of two: indices are masked, not reduced */
+#define CIRC_BUFFER_SIZE 1024               /* default */
+#define CIRC_BUFFER_MIN_SIZE WII_RING_MIN_SIZE
+#define CIRC_BUFFER_MAX_SIZE WII_RING_MAX_SIZE
+
+/* Written by the producer only; read without synchronisation for reporting */
+struct circ_buffer_stats {
+    unsigned long enqueued;         /* records stored */
+    unsigned long dropped;          /* new records refused because the ring was full */
+    unsigned long overwritten;      /* old records discarded to make room */
+    unsigned int high_water;        /* most bytes ever queued at once */
+};
+
+/*
+ * The indices live in hdr, which is shared with user space. head and tail run
+ * freely and wrap at UINT_MAX; head - tail is the number of bytes queued, and
+ * only (index & (size - 1)) touches data.
+ */
+struct circ_buffer {
+    struct wii_ring_header *hdr;    /* first page of the vmalloc'd mapping */
+    char *data;                     /* size bytes, starting on the next page */
+    unsigned int size;
+    unsigned int record_size;       /* fixed record size, 0 for a byte stream */
+    unsigned int head;              /* producer's private copy of hdr->head */
+    bool overwrite;                 /* reclaim the oldest records when full */
+    struct circ_buffer_stats stats;
+    wait_queue_head_t *wait;        /* readers sleeping for data, woken by the producer */
+};
+
+/*
+ * circ_buffer_create - allocate a ring of size bytes (a power of two).
+ *
+ * record_size is the size every write will have, which is what lets the
+ * producer reclaim whole records; pass 0 for variable-length data, in which
+ * case overwrite cannot be enabled. wait belongs to the caller so that it
+ * outlives any one ring, and may be NULL for a consumer that never sleeps on
+ * the ring. Returns an ERR_PTR() on failure.
+ */
+struct circ_buffer *circ_buffer_create(unsigned int size, unsigned int record_size,
+                                       wait_queue_head_t *wait);
+void circ_buffer_destroy(struct circ_buffer *cb);
+int circ_buffer_set_overwrite(struct circ_buffer *cb, bool overwrite);
+
+/* Maps the header page and the ring data into user space */
+int circ_buffer_mmap(struct circ_buffer *cb, struct vm_area_struct *vma);
+
+/*
+ * Producer side: stores the whole record and returns len, or stores nothing
+ * and returns 0. Wakes any reader sleeping on cb->wait; never sleeps itself.
+ */
+size_t circ_buffer_write(struct circ_buffer *cb, const char *data, size_t len);
+
+/*
+ * Consumer side: circ_buffer_read_begin() snapshots tail, circ_buffer_peek()
+ * points *ptr at the bytes readable at pos and returns how many are
+ * contiguous there, so the whole queue is covered by at most two peeks (one
+ * on each side of the wrap point). circ_buffer_read_commit() then moves tail
+ * from the snapshot to the end of what was read; it fails if the producer
+ * overwrote those records meanwhile, and the read must be redone.
+ */
+bool circ_buffer_empty(struct circ_buffer *cb);
+unsigned int circ_buffer_queued(struct circ_buffer *cb);
+unsigned int circ_buffer_read_begin(struct circ_buffer *cb);
+size_t circ_buffer_peek(struct circ_buffer *cb, unsigned int pos, const char **ptr);
+bool circ_buffer_read_commit(struct circ_buffer *cb, unsigned int tail, unsigned int pos);
+
+#endif /* WII_CIRCULARBUFFER_H */
@@ -0,0 +1,202 @@
+/*
+ * wii-remote-decode.c - input report decoding for the Wii Remote driver.
+ *
+ * Turns one raw input report into a struct wii_event, and optionally fills in
+ * its derived fields. Nothing here touches driver state beyond what is passed
+ * in, so the same source is built into the module and into the userspace
+ * benchmark under bench/, which replays captured reports through it.
+ */
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/types.h>
+
+#include "wii-remote-decode.h"
+
+/* Unpack one dot in the 3-byte layout shared by the extended and full IR formats */
+static void wii_decode_ir_dot(const u8 *p, struct wii_ir_dot *dot)
+{
+    dot->x = p[0] | ((p[2] & 0x30) << 4);
+    dot->y = p[1] | ((p[2] & 0xc0) << 2);
+    dot->size = p[2] & 0x0f;
+}
+
+static void wii_decode_ir(const u8 *p, u8 format, struct wii_event *ev)
+{
+    int i;
+
+    switch (format) {
+    case WII_IR_BASIC:
+        /* Two 5-byte groups, each packing two dots without a size */
+        for (i = 0; i < WII_IR_DOTS; i += 2, p += 5) {
+            ev->ir[i].x = p[0] | ((p[2] & 0x30) << 4);
+            ev->ir[i].y = p[1] | ((p[2] & 0xc0) << 2);
+            ev->ir[i + 1].x = p[3] | ((p[2] & 0x03) << 8);
+            ev->ir[i + 1].y = p[4] | ((p[2] & 0x0c) << 6);
+        }
+        break;
+    case WII_IR_EXTENDED:
+        for (i = 0; i < WII_IR_DOTS; i++)
+            wii_decode_ir_dot(p + i * 3, &ev->ir[i]);
+        break;
+    default:
+        return;
+    }
+    ev->flags |= WII_EVENT_F_IR;
+}
+
+/*
+ * wii_decode_report - decode one input report into ev using the layout table.
+ *
+ * Returns false when the report produces no event: unknown or short reports,
+ * and the first half of an interleaved (0x3e/0x3f) pair, which is kept in
+ * state and merged into the event for the second half.
+ */
+bool wii_decode_report(struct wii_decode_state *state, const u8 *data, int size,
+                       struct wii_event *ev)
+{
+    const struct wii_report_layout *layout;
+    const u8 *bb = &data[1];
+    int i;
+
+    if (size < 1)
+        return false;
+    layout = wii_report_layout(data[0]);
+    if (!layout)
+        return false;
+    if (size < layout->len) {
+        printk_ratelimited(KERN_WARNING DRIVER_NAME ": Report 0x%02x too short for mapping\n", data[0]);
+        return false;
+    }
+
+    ev->version = WII_EVENT_VERSION;
+    ev->report_id = data[0];
+
+    if (layout->buttons) {
+        bb = &data[layout->buttons];
+        ev->buttons = (bb[0] | (bb[1] << 8)) & WII_BTN_BITS;
+        ev->flags |= WII_EVENT_F_BUTTONS;
+    }
+
+    if (layout->status) {
+        ev->status = data[layout->status] & WII_STATUS_FLAGS;
+        ev->battery = data[layout->status + WII_STATUS_BATTERY];
+        ev->flags |= WII_EVENT_F_BATTERY;
+    }
+
+    switch (layout->interleaved) {
+    case 1:
+        state->accel_x = data[layout->accel];
+        state->accel_z_high = (((bb[0] >> 5) & 0x03) << 4) | (((bb[1] >> 5) & 0x03) << 6);
+        memcpy(state->ir, &data[layout->ir], WII_IR_FULL_HALF_LEN);
+        state->have_first_half = true;
+        return false;
+    case 2:
+        if (!state->have_first_half)
+            return false;
+        state->have_first_half = false;
+
+        /* Only 8 bits per axis survive interleaving; scale to the 10-bit range */
+        ev->accel[0] = state->accel_x << 2;
+        ev->accel[1] = data[layout->accel] << 2;
+        ev->accel[2] = (state->accel_z_high | ((bb[0] >> 5) & 0x03) |
+                        (((bb[1] >> 5) & 0x03) << 2)) << 2;
+        ev->flags |= WII_EVENT_F_ACCEL;
+        if (!IS_ENABLED(CONFIG_WII_REMOTE_IR))
+            return true;
+
+        ev->flags |= WII_EVENT_F_IR;
+        for (i = 0; i < 2; i++) {
+            wii_decode_ir_dot(state->ir + i * WII_IR_FULL_DOT_LEN, &ev->ir[i]);
+            wii_decode_ir_dot(&data[layout->ir + i * WII_IR_FULL_DOT_LEN], &ev->ir[i + 2]);
+        }
+        return true;
+    }
+
+    if (layout->accel) {
+        const u8 *accel = &data[layout->accel];
+
+        ev->accel[0] = (accel[0] << 2) | ((bb[0] >> 5) & 0x03);
+        ev->accel[1] = (accel[1] << 2) | ((bb[1] >> 4) & 0x02);
+        ev->accel[2] = (accel[2] << 2) | ((bb[1] >> 5) & 0x02);
+        ev->flags |= WII_EVENT_F_ACCEL;
+    }
+
+    if (IS_ENABLED(CONFIG_WII_REMOTE_IR) && layout->ir)
+        wii_decode_ir(&data[layout->ir], layout->ir_format, ev);
+
+    if (layout->ext_len) {
+        memcpy(ev->ext, &data[layout->ext], layout->ext_len);
+        ev->ext_len = layout->ext_len;
+        ev->flags |= WII_EVENT_F_EXT;
+    }
+    return true;
+}
+
+/* atan(z / 32768) in hundredths of a degree for 0 <= z <= 32768, within 0.25 degrees */
+static int wii_atan_q15(int z)
+{
+    return (4500 * z + 1564 * ((z * (32768 - z)) >> 15)) >> 15;
+}
+
+/* atan2(y, x) in hundredths of a degree; |x| and |y| must stay below 65536 */
+static int wii_atan2_cdeg(int y, int x)
+{
+    int ax = abs(x), ay = abs(y), a;
+
+    if (!ax && !ay)
+        return 0;
+    if (ax >= ay)
+        a = wii_atan_q15((ay << 15) / ax);
+    else
+        a = 9000 - wii_atan_q15((ax << 15) / ay);
+    if (x < 0)
+        a = 18000 - a;
+    return y < 0 ? -a : a;
+}
+
+/* Camera image size and the value an IR coordinate has for an untracked dot */
+#define WII_IR_WIDTH     1024
+#define WII_IR_HEIGHT    768
+#define WII_IR_UNTRACKED 0x3ff
+
+/*
+ * wii_derive_event - compute the derived fields of ev from its raw motion
+ * data. Integer only: acceleration is scaled with the remote's calibration,
+ * tilt comes from a polynomial atan2() and the pointer is plain Q15.
+ */
+void wii_derive_event(const struct wii_calibration *calib, struct wii_event *ev)
+{
+    const struct wii_ir_dot *dot[2];
+    int i, n, range, x, y, z;
+
+    if (ev->flags & WII_EVENT_F_ACCEL) {
+        /* one_g is always above zero, see wii_parse_calibration() */
+        for (i = 0; i < 3; i++) {
+            range = calib->one_g[i] - calib->zero[i];
+            ev->accel_mg[i] = clamp_t(int, (ev->accel[i] - calib->zero[i]) * 1000 / range,
+                                      S16_MIN, S16_MAX);
+        }
+        x = ev->accel_mg[0];
+        y = ev->accel_mg[1];
+        z = ev->accel_mg[2];
+        /* Each square fits an int, their sum only unsigned: up to 2^31 */
+        ev->pitch = wii_atan2_cdeg(y, int_sqrt((u32)(x * x) + (u32)(z * z)));
+        ev->roll = wii_atan2_cdeg(x, z);
+        ev->flags |= WII_EVENT_F_TILT;
+    }
+
+    if (IS_ENABLED(CONFIG_WII_REMOTE_IR) && (ev->flags & WII_EVENT_F_IR)) {
+        for (i = 0, n = 0; i < WII_IR_DOTS && n < 2; i++)
+            if (ev->ir[i].x != WII_IR_UNTRACKED && ev->ir[i].y != WII_IR_UNTRACKED)
+                dot[n++] = &ev->ir[i];
+        if (n == 2) {
+            /* The camera sees the sensor bar move opposite to where it points */
+            x = WII_IR_WIDTH - (dot[0]->x + dot[1]->x);
+            y = WII_IR_HEIGHT - (dot[0]->y + dot[1]->y);
+            ev->pointer_x = clamp(x * 32767 / WII_IR_WIDTH, -32767, 32767);
+            ev->pointer_y = clamp(y * 32767 / WII_IR_HEIGHT, -32767, 32767);
+            ev->flags |= WII_EVENT_F_POINTER;
+        }
+    }
+}
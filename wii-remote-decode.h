@@ -0,0 +1,27 @@
+/*
+ * wii-remote-decode.h - the report decoder, shared by the driver and the
+ * userspace benchmark under bench/.
+ */
+
+#ifndef WII_REMOTE_DECODE_H
+#define WII_REMOTE_DECODE_H
+
+#include <linux/types.h>
+
+#include "wii-remote.h"
+#include "wii-remote-descriptor.h"
+
+/* Prefix of every message the driver logs */
+#define DRIVER_NAME "wii_remote_driver"
+
+/*
+ * wii_decode_report - decode one input report into ev, which the caller has
+ * zeroed. Returns false when the report produces no event.
+ */
+bool wii_decode_report(struct wii_decode_state *state, const u8 *data, int size,
+                       struct wii_event *ev);
+
+/* Fill in the derived fields of a decoded event; calib must be sane */
+void wii_derive_event(const struct wii_calibration *calib, struct wii_event *ev);
+
+#endif /* WII_REMOTE_DECODE_H */
@@ -0,0 +1,174 @@
+/*
+ * wii-remote-descriptor.h - layout of the Wii Remote's input reports.
+ *
+ * The remote does not describe its reports through the HID descriptor in any
+ * useful way, so the byte layout of every data reporting mode is spelled out
+ * here. Offsets count from data[0], the report ID.
+ *
+ * Core buttons (2 bytes, present in every report except 0x3d):
+ *   Byte 0: Bit 0: D-pad Left    Bit 1: D-pad Right   Bit 2: D-pad Down
+ *           Bit 3: D-pad Up      Bit 4: Plus          Bits 5-6: accel LSBs
+ *   Byte 1: Bit 0: Button 2      Bit 1: Button 1      Bit 2: B
+ *           Bit 3: A             Bit 4: Minus         Bits 5-6: accel LSBs
+ *           Bit 7: Home
+ *
+ * Accelerometer (3 bytes): the upper 8 bits of X, Y and Z. X gets two more
+ * bits from bits 5-6 of button byte 0; Y and Z get bit 1 from bits 5 and 6 of
+ * button byte 1, so they only have 9 significant bits.
+ *
+ * IR camera, one of:
+ *   basic    (10 bytes) two 5-byte groups of two dots:
+ *            X1, Y1, [Y1 9:8 | X1 9:8 | Y2 9:8 | X2 9:8], X2, Y2
+ *   extended (12 bytes) four 3-byte dots: X, Y, [Y 9:8 | X 9:8 | size]
+ *   full     (36 bytes over reports 0x3e and 0x3f) four 9-byte dots: the
+ *            extended bytes followed by a bounding box and intensity
+ * Untracked dots read back as all ones.
+ *
+ * Interleaved mode (0x3e/0x3f) carries only 8 bits of X (in 0x3e) and of Y
+ * (in 0x3f); Z is split into nibbles across bits 5-6 of both button bytes.
+ *
+ * Status (0x20, after the buttons):
+ *   Byte 3: Bit 0: battery low   Bit 1: extension connected
+ *           Bit 2: speaker on    Bit 3: IR camera on    Bits 4-7: LEDs 1-4
+ *   Bytes 4-5: unused            Byte 6: battery level
+ */
+
+#ifndef WII_REMOTE_DESCRIPTOR_H
+#define WII_REMOTE_DESCRIPTOR_H
+
+#include <linux/types.h>
+
+#define WII_REPORT_FIRST        0x20
+#define WII_REPORT_LAST         0x3f
+#define WII_REPORT_MAX_LEN      22
+
+/* Mask of the button bits inside the little-endian pair of button bytes */
+#define WII_BTN_BITS            0x9f1f
+
+/*
+ * Memory reads (output report 0x17: address space, 24-bit address and 16-bit
+ * length, big-endian) are answered by 0x21 reports of up to 16 bytes each:
+ *   Byte 3: Bits 4-7: bytes in this report - 1    Bits 0-3: error, 0 for none
+ *   Bytes 4-5: low 16 bits of the address, big-endian
+ *   Bytes 6-21: data
+ *
+ * The accelerometer calibration is a 10-byte EEPROM block at 0x16, repeated at
+ * 0x20: zero X, Y, Z (bits 9:2), their bits 1:0 packed as X << 4 | Y << 2 | Z,
+ * the same four bytes for +1 g, one unrelated byte, and a checksum that is the
+ * sum of the first nine bytes plus 0x55.
+ */
+#define WII_MEM_EEPROM          0x00
+#define WII_MEM_REGISTERS       0x04
+#define WII_MEM_REPLY_DATA      6
+#define WII_CALIB_ADDR          0x0016
+#define WII_CALIB_ADDR_COPY     0x0020
+#define WII_CALIB_LEN           10
+
+/*
+ * Register writes (output report 0x16: address space, 24-bit address, length,
+ * then 16 data bytes) are answered by an acknowledgement, report 0x22:
+ *   Byte 3: ID of the output report acknowledged    Byte 4: error, 0 for none
+ * Any other output report is acknowledged too when bit 1 of its first byte is
+ * set.
+ *
+ * The IR camera is brought up by enabling its clock (0x13) and logic (0x1a)
+ * with bit 2 set, writing 0x08 to register 0xb00030, the two sensitivity
+ * blocks to 0xb00000 (9 bytes) and 0xb0001a (2 bytes), the mode to 0xb00033
+ * and 0x08 to 0xb00030 once more.
+ */
+#define WII_OUT_ACK_REQUEST     0x02
+#define WII_ACK_REPORT          3
+#define WII_ACK_ERROR           4
+#define WII_WRITE_DATA          6
+#define WII_WRITE_MAX_LEN       16
+#define WII_IR_ENABLE           0x04
+#define WII_IR_REG_CONTROL      0xb00030
+#define WII_IR_REG_SENS1        0xb00000
+#define WII_IR_REG_SENS2        0xb0001a
+#define WII_IR_REG_MODE         0xb00033
+#define WII_IR_SENS1_LEN        9
+#define WII_IR_SENS2_LEN        2
+
+/* Status report flags byte; the low nibble is WII_STATUS_F_* as is */
+#define WII_STATUS_FLAGS        0x0f
+#define WII_STATUS_LEDS_SHIFT   4
+#define WII_STATUS_BATTERY      3       /* battery byte, after the flags byte */
+
+enum wii_ir_format {
+    WII_IR_NONE = 0,
+    WII_IR_BASIC,
+    WII_IR_EXTENDED,
+    WII_IR_FULL,
+};
+
+#define WII_IR_BASIC_LEN        10
+#define WII_IR_EXTENDED_LEN     12
+#define WII_IR_FULL_HALF_LEN    18     /* two 9-byte dots per report */
+#define WII_IR_FULL_DOT_LEN     9
+
+/*
+ * struct wii_report_layout - where each field sits in one input report.
+ * Offsets are 0 when the field is absent (byte 0 is always the report ID).
+ */
+struct wii_report_layout {
+    u8 len;             /* bytes including the report ID, 0 for unknown IDs */
+    u8 buttons;
+    u8 accel;
+    u8 ir;
+    u8 ir_format;       /* enum wii_ir_format */
+    u8 ext;
+    u8 ext_len;
+    u8 interleaved;     /* 1 for 0x3e, 2 for 0x3f */
+    u8 status;          /* flags byte of a status report; battery follows 3 later */
+};
+
+/* Indexed by report ID - WII_REPORT_FIRST */
+static const struct wii_report_layout wii_report_layouts[] = {
+    /* status, memory read data, acknowledge: buttons only for decoding */
+    [0x20 - WII_REPORT_FIRST] = { .len = 7,  .buttons = 1, .status = 3 },
+    [0x21 - WII_REPORT_FIRST] = { .len = 22, .buttons = 1 },
+    [0x22 - WII_REPORT_FIRST] = { .len = 5,  .buttons = 1 },
+
+    /* data reporting modes */
+    [0x30 - WII_REPORT_FIRST] = { .len = 3,  .buttons = 1 },
+    [0x31 - WII_REPORT_FIRST] = { .len = 6,  .buttons = 1, .accel = 3 },
+    [0x32 - WII_REPORT_FIRST] = { .len = 11, .buttons = 1, .ext = 3, .ext_len = 8 },
+    [0x33 - WII_REPORT_FIRST] = { .len = 18, .buttons = 1, .accel = 3,
+                                  .ir = 6, .ir_format = WII_IR_EXTENDED },
+    [0x34 - WII_REPORT_FIRST] = { .len = 22, .buttons = 1, .ext = 3, .ext_len = 19 },
+    [0x35 - WII_REPORT_FIRST] = { .len = 22, .buttons = 1, .accel = 3,
+                                  .ext = 6, .ext_len = 16 },
+    [0x36 - WII_REPORT_FIRST] = { .len = 22, .buttons = 1, .ir = 3,
+                                  .ir_format = WII_IR_BASIC, .ext = 13, .ext_len = 9 },
+    [0x37 - WII_REPORT_FIRST] = { .len = 22, .buttons = 1, .accel = 3, .ir = 6,
+                                  .ir_format = WII_IR_BASIC, .ext = 16, .ext_len = 6 },
+    [0x3d - WII_REPORT_FIRST] = { .len = 22, .ext = 1, .ext_len = 21 },
+    [0x3e - WII_REPORT_FIRST] = { .len = 22, .buttons = 1, .accel = 3, .ir = 4,
+                                  .ir_format = WII_IR_FULL, .interleaved = 1 },
+    [0x3f - WII_REPORT_FIRST] = { .len = 22, .buttons = 1, .accel = 3, .ir = 4,
+                                  .ir_format = WII_IR_FULL, .interleaved = 2 },
+};
+
+static inline const struct wii_report_layout *wii_report_layout(u8 report_id)
+{
+    const struct wii_report_layout *layout;
+
+    if (report_id < WII_REPORT_FIRST || report_id > WII_REPORT_LAST)
+        return NULL;
+    layout = &wii_report_layouts[report_id - WII_REPORT_FIRST];
+    return layout->len ? layout : NULL;
+}
+
+/*
+ * struct wii_decode_state - what the decoder carries from one report to the
+ * next. Only interleaved mode needs it: 0x3e is held back until the matching
+ * 0x3f arrives, and the two are emitted as one event.
+ */
+struct wii_decode_state {
+    bool have_first_half;
+    u8 accel_x;             /* upper 8 bits from 0x3e */
+    u8 accel_z_high;        /* Z bits 7:4 from 0x3e */
+    u8 ir[WII_IR_FULL_HALF_LEN];
+};
+
+#endif /* WII_REMOTE_DESCRIPTOR_H */
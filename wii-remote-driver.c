@@ -2,14 +2,32 @@
  * wii_remote_driver.c - A character/HID driver for a Wii Remote.
  *
  * This driver registers as a HID driver to capture raw reports from the Wii remote.
- * It performs basic input mapping (using button bit masks from your older working code)
- * and writes human-readable results to a circular buffer. The circular buffer is then
- * exposed via a character device (/dev/wii_remote) for user-space consumption.
+ * It decodes every data reporting mode (layouts in wii-remote-descriptor.h, decoder in
+ * wii-remote-decode.c) and writes one binary struct wii_event per report (see wii-remote.h)
+ * to a circular buffer, or human-readable lines when the text_events parameter is set. The circular
+ * buffer is then exposed via a character device (/dev/wii_remoteN) for user-space consumption.
+ *
+ * Each connected remote (up to WII_MAX_REMOTES) gets its own struct wii_remote with its
+ * own device node and /proc/wii_remote/remoteN entry, so remotes never share state.
+ * Every open file of a remote gets its own buffer: reports are decoded once and the
+ * result is copied to each reader, so several processes can follow the same remote.
+ * The same decoded state is also reported through an input device, so evdev users
+ * (libinput, SDL, ...) need nothing driver-specific. /dev/wii_remote_all merges the
+ * events of every remote into one stream for a single reader.
+ *
+ * By default the HID callback only timestamps each report and queues it, together
+ * with copies for readers that asked for raw reports; decoding runs in a per-remote
+ * workqueue so the Bluetooth receive path is never held up by it.
  *
  * Additionally, an ioctl command triggers an output report (command 0x15) to request
  * a battery/status update, and the corresponding battery level (report ID 0x20) is also
- * written into the buffer. A /proc entry is created to report driver state.
+ * written into the buffer. Output reports are queued and sent from a worker, so no
+ * ioctl waits for the radio. A /proc entry is created to report driver state.
  *
+ * Optional parts (text format, statistics, tracing, IR, derived data) are
+ * selected by CONFIG_WII_REMOTE_* from the Makefile. They are tested with
+ * IS_ENABLED() rather than #ifdef wherever possible, so disabled code is still
+ * compiled and type-checked, then dropped by the compiler.
  */
 
 #include <linux/module.h>
@@ -24,166 +42,2038 @@
 #include <linux/string.h>
 #include <linux/ioctl.h>
 #include <linux/proc_fs.h>
+#include <linux/debugfs.h>
+#include <linux/capability.h>
 #include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/moduleparam.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/idr.h>
+#include <linux/input.h>
+#include <linux/rcupdate.h>
+#include <linux/rculist.h>
+#include <linux/atomic.h>
+#include <linux/mm.h>
+#include <linux/log2.h>
+#include <linux/err.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/seqlock.h>
+#include <linux/percpu.h>
+#include <linux/math64.h>
+#include <linux/hrtimer.h>
+#include <linux/overflow.h>
+
+#include "circularbuffer.h"
+#include "wii-remote.h"
+#include "wii-remote-descriptor.h"
+#include "wii-remote-decode.h"
+
+#ifdef CONFIG_WII_REMOTE_TRACE
+#define CREATE_TRACE_POINTS
+#include "wii-remote-trace.h"
+#else
+static inline void trace_wii_raw_report(const u8 *data, int size) { }
+#endif
 
-#define DRIVER_NAME "wii_remote_driver"
 #define DEVICE_NAME "wii_remote"
-#define CIRC_BUFFER_SIZE 1024
+#define WII_MAX_REMOTES 4
+#define WII_ALL_MINOR WII_MAX_REMOTES   /* /dev/wii_remote_all, after the remotes */
+
+/* Pending output reports per remote; a power of two */
+#define WII_OUT_QUEUE_LEN 32
+#define WII_OUT_MAX_LEN 22
+
+struct wii_output {
+    u8 len;
+    u8 data[WII_OUT_MAX_LEN];
+};
+
+/* Typical calibration, used until the remote's own is known */
+#define WII_ACCEL_ZERO_NOMINAL  0x200
+#define WII_ACCEL_ONE_G_NOMINAL 0x268
+/* Smallest believable one_g - zero, under a third of the nominal range */
+#define WII_CALIB_MIN_RANGE     32
+
+/* IR camera set-up: two enables and five register writes, each acknowledged */
+#define WII_IR_MAX_STEPS 7
+#define WII_IR_TIMEOUT_MS 500
+
+/* Rumble/LED patterns change state at most once per input report interval */
+#define WII_FEEDBACK_MIN_NS (10 * NSEC_PER_MSEC)
+#define WII_LEDS_UNKNOWN 0xff
+
+/*
+ * struct wii_pattern_play - a WIIMOTE_IOCTL_SET_PATTERN pattern being played.
+ * Steps repeating the state before them are already folded together; each
+ * ends end_ns after the start of the pass.
+ */
+struct wii_pattern_play {
+    unsigned int count;
+    unsigned int repeat;            /* passes to play, 0 for no end */
+    unsigned int passes;            /* completed, with repeat */
+    u64 start_ns;                   /* start of the current pass */
+    u64 length_ns;                  /* of one pass */
+    struct {
+        u64 end_ns;
+        u8 leds;
+        bool rumble;
+    } steps[];
+};
+
+/* Raw reports waiting for decode_work; 128 reports, over a second at 100 Hz */
+#define WII_RAW_RING_SIZE (128 * sizeof(struct wii_raw_report))
+
+/* Histogram bucket b counts samples below 2^b microseconds; the last one the rest */
+#define WII_HIST_BUCKETS 16
+
+/*
+ * struct wii_pcpu_stats - counters for /proc, one copy per CPU so that the
+ * raw event path and readers never share a cache line. Every field is an
+ * unsigned long; wii_sum_stats() relies on that. Not allocated, and every
+ * update compiled out, without CONFIG_WII_REMOTE_STATS.
+ */
+struct wii_pcpu_stats {
+    unsigned long reports[WII_REPORT_LAST - WII_REPORT_FIRST + 1];
+    unsigned long reports_other;        /* IDs outside the table, output acks etc. */
+    unsigned long bytes_received;       /* raw report bytes */
+    unsigned long bytes_enqueued;       /* summed over all readers */
+    unsigned long bytes_read;           /* through read() and the batch ioctl */
+    unsigned long handler_hist[WII_HIST_BUCKETS];   /* wii_raw_event() run time */
+    unsigned long decode_hist[WII_HIST_BUCKETS];    /* decode of one report */
+    unsigned long latency_hist[WII_HIST_BUCKETS];   /* arrival to read of the oldest record */
+};
+
+/*
+ * Legacy text output instead of struct wii_event records. Fixed at load time
+ * because each ring is framed for one format when the remote connects.
+ */
+static bool text_events;
+#ifdef CONFIG_WII_REMOTE_TEXT
+module_param(text_events, bool, 0444);
+MODULE_PARM_DESC(text_events, "Emit human-readable text lines instead of binary event records");
+#endif
+
+/* Register an input device per remote next to the character device */
+static bool input_device = true;
+module_param(input_device, bool, 0444);
+MODULE_PARM_DESC(input_device, "Also report buttons, accelerometer and IR through an evdev input device (default: on)");
+
+/* Create /dev/wii_remote_all; never with text_events */
+static bool aggregate_device = true;
+module_param(aggregate_device, bool, 0444);
+MODULE_PARM_DESC(aggregate_device, "Create /dev/wii_remote_all carrying the events of every remote (default: on)");
+
+/* Drop reports that repeat the previous state instead of queuing them */
+static bool button_edges = true;
+module_param(button_edges, bool, 0644);
+MODULE_PARM_DESC(button_edges, "Only queue events for button presses/releases and changed motion data (default: on)");
+
+/* What a full ring does with a new record: WII_DROP_NEWEST or WII_DROP_OLDEST */
+static unsigned int drop_policy = WII_DROP_NEWEST;
+module_param(drop_policy, uint, 0644);
+MODULE_PARM_DESC(drop_policy, "Initial full-buffer policy for new readers: 0 drop newest, 1 overwrite oldest (binary mode only)");
+
+/* Buffer size for new readers; WIIMOTE_IOCTL_SET_RING_SIZE changes it per reader */
+static unsigned int ring_size = CIRC_BUFFER_SIZE;
+module_param(ring_size, uint, 0644);
+MODULE_PARM_DESC(ring_size, "Buffer size in bytes for newly opened readers, rounded up to a power of two (default: 1024)");
+
+/* Fill in the derived fields of each binary event record */
+static bool derived_data;
+#ifdef CONFIG_WII_REMOTE_DERIVED
+module_param(derived_data, bool, 0644);
+MODULE_PARM_DESC(derived_data, "Add calibrated acceleration, tilt and IR pointer to each event (default: off)");
+#endif
+
+/* Decode in a per-remote workqueue rather than in the HID callback */
+static bool deferred_decode = true;
+module_param(deferred_decode, bool, 0444);
+MODULE_PARM_DESC(deferred_decode, "Decode reports in a workqueue instead of the HID receive callback (default: on)");
+
+/* IR camera mode to set up on connect, WII_IR_CAMERA_*; 0 leaves it alone */
+static unsigned int ir_mode;
+static unsigned int ir_sensitivity = 3;
+#ifdef CONFIG_WII_REMOTE_IR
+module_param(ir_mode, uint, 0644);
+MODULE_PARM_DESC(ir_mode, "IR camera mode to set up on connect: 1 basic, 3 extended, 5 full (default: 0, none)");
+module_param(ir_sensitivity, uint, 0644);
+MODULE_PARM_DESC(ir_sensitivity, "IR camera sensitivity for ir_mode, 1 (least) to 5 (default: 3)");
+#endif
+
+static unsigned int motion_coalesce_us;
+module_param(motion_coalesce_us, uint, 0644);
+MODULE_PARM_DESC(motion_coalesce_us, "Minimum interval between queued motion-only samples in microseconds (default: 0, every sample)");
+
+/* Throttle reporting while nobody listens or the remote lies still */
+static bool power_save = true;
+module_param(power_save, bool, 0644);
+MODULE_PARM_DESC(power_save, "Report buttons only while unused and changes only while still (default: on)");
+
+static unsigned int idle_timeout_ms = 10000;
+module_param(idle_timeout_ms, uint, 0644);
+MODULE_PARM_DESC(idle_timeout_ms, "Stillness before continuous reporting is turned off in ms, 0 never (default: 10000)");
+
+static unsigned int idle_motion = 6;
+module_param(idle_motion, uint, 0644);
+MODULE_PARM_DESC(idle_motion, "Accelerometer change in raw units that counts as motion (default: 6, about 0.06 g)");
+
+/*
+ * Whether an open input device keeps a remote out of WII_IDLE_UNUSED. Off by
+ * default: the console keyboard handler binds to anything with arrow keys
+ * and holds the device open from registration on, so the remote would never
+ * count as unused on a kernel with CONFIG_VT.
+ */
+static bool input_users;
+module_param(input_users, bool, 0444);
+MODULE_PARM_DESC(input_users, "Count an open input device as a user for power_save; the VT keyboard handler keeps it open (default: off)");
+
+/* How far reporting is throttled; the requested mode is sent as is when active */
+enum wii_idle {
+    WII_IDLE_ACTIVE = 0,
+    WII_IDLE_STILL,         /* still for idle_timeout_ms: continuous reporting off */
+    WII_IDLE_UNUSED,        /* no user (see wii_user_get()): buttons only (0x30) */
+};
+
+/*
+ * struct wii_remote - state of one connected remote, allocated in wii_probe().
+ *
+ * The allocation is owned by dev. cdev_device_add() makes the cdev hold a
+ * reference on dev for as long as any file is open, so readers (and their
+ * mappings) stay valid after wii_remove() has run.
+ */
+struct wii_remote {
+    struct device dev;              /* /dev/wii_remoteN */
+    struct cdev cdev;
+    int index;                      /* N, or -1 before one is allocated */
+
+    struct mutex lock;              /* serialises output reports against wii_remove() */
+    struct hid_device *hdev;        /* NULL once disconnected */
+    bool connected;
+
+    /*
+     * Last known state for WIIMOTE_IOCTL_GET_STATUS and /proc. Written from the
+     * raw event path and out_work, read locklessly through wii_get_status().
+     */
+    seqlock_t status_lock;
+    struct wii_status status;       /* age_ns is filled in by the reader */
+    u64 status_ns;                  /* arrival of the last 0x20 report, 0 for none */
+    u64 status_request_ns;          /* last refresh queued by WIIMOTE_IOCTL_GET_STATUS */
+
+    /*
+     * Raw reports from wii_raw_event() to decode_work, with deferred_decode.
+     * decode_wq is ordered, so decoding is single-threaded like the callback.
+     */
+    struct circ_buffer *raw_ring;
+    struct workqueue_struct *decode_wq;
+    struct work_struct decode_work;
+
+    struct wii_decode_state decode; /* only touched by the decoder */
+    struct wii_calibration calib;   /* written under status_lock from the raw event path */
+    u16 last_buttons;               /* button state of the last decoded event */
+    struct wii_event last_motion;   /* last queued event that carried motion data */
+    struct input_dev *input;        /* NULL with input_device=0 */
+
+    /*
+     * Output reports waiting for out_work, which sends them in order. The
+     * queue is protected by out_lock so that it can be filled from any
+     * context; out_work alone takes lock to send.
+     */
+    spinlock_t out_lock;
+    struct work_struct out_work;
+    struct wii_output out_queue[WII_OUT_QUEUE_LEN];
+    unsigned int out_head, out_tail;    /* free running */
+    bool out_closed;                    /* refuses new reports before hid_hw_start() and after remove */
+    bool rumble;                        /* bit 0 of every output report */
+    u8 leds;                            /* last queued, or WII_LEDS_UNKNOWN */
+    u8 req_mode;                        /* mode asked for, re-sent after status reports */
+    bool req_continuous;
+    u8 idle;                            /* enum wii_idle the sent mode reflects */
+    unsigned long idle_changes;
+    unsigned long out_sent;
+    unsigned long out_coalesced;        /* replaced by a newer report before sending */
+    unsigned long out_failed;
+
+    /*
+     * IR camera set-up in flight, under out_lock: the report IDs whose
+     * acknowledgements are still expected, in order. See wii_ir_start().
+     */
+    u8 ir_state;                        /* WII_IR_STATE_* */
+    u8 ir_mode;                         /* WII_IR_CAMERA_* being set up */
+    u8 ir_acks[WII_IR_MAX_STEPS];
+    unsigned int ir_step, ir_steps;
+    u64 ir_start_ns;
+    struct delayed_work ir_timeout;
+
+    /*
+     * Rumble/LED pattern played by pattern_timer, NULL when none is. The
+     * pointer and feedback_ns, when the timer last set a state, are under
+     * out_lock; pattern_lock serialises starting and stopping.
+     */
+    struct wii_pattern_play *pattern;
+    struct hrtimer pattern_timer;
+    struct mutex pattern_lock;
+    u64 feedback_ns;
+
+    /*
+     * Idle tracking. users counts open files and a running capture, plus an
+     * open input device with input_users; active_ns is the last open or mode
+     * change. still_ns and still_accel, where the accelerometer last
+     * settled, belong to the decoder. idle_work moves idle to idle_target.
+     */
+    atomic_t users;
+    u64 active_ns;
+    u64 still_ns;
+    u16 still_accel[3];
+    u8 idle_target;
+    struct work_struct idle_work;
+
+    struct wii_pcpu_stats __percpu *pstats;     /* NULL without CONFIG_WII_REMOTE_STATS */
+    u64 connected_ns;                   /* probe time, for the report rates */
+
+    /*
+     * Open files, each with its own ring. The HID callback walks the list under
+     * RCU and writes every event to each ring; open and release change it under
+     * readers_lock.
+     */
+    struct list_head readers;
+    struct mutex readers_lock;
+    unsigned int record_size;       /* sizeof(struct wii_event), or 0 in text mode */
+
+    /* This remote's source for /dev/wii_remote_all while it is open, else NULL */
+    struct circ_buffer __rcu *all_ring;
+
+    struct proc_dir_entry *proc_entry;
+
+    /*
+     * Capture of every raw report for debugfs, off while capture is NULL.
+     * wii_raw_event() writes it under RCU; capture_lock serialises the
+     * debugfs reader against WIIMOTE_IOCTL_SET_CAPTURE replacing it.
+     */
+    struct circ_buffer __rcu *capture;
+    struct mutex capture_lock;
+    wait_queue_head_t capture_wait;
+    bool capture_closed;                /* set by wii_remove(); readers see EOF */
+    struct dentry *capture_file;
+};
+
+/*
+ * struct wii_reader - one open file of a remote, allocated in device_open().
+ *
+ * The HID callback (or the decoder) is the only producer of ring and never
+ * blocks; it finds the ring under RCU so that wii_replace_ring() can swap it.
+ * read_lock serialises read(), mmap, resizing and format changes on this file.
+ * Producers tell a raw ring from an event ring by its record size.
+ */
+struct wii_reader {
+    struct wii_remote *remote;
+    struct list_head node;          /* on remote->readers */
+    struct circ_buffer __rcu *ring;
+    struct mutex read_lock;
+    wait_queue_head_t read_wait;    /* outlives any one ring */
+    bool overwrite;                 /* WII_DROP_OLDEST, carried across resizes */
+    bool raw;                       /* WII_FORMAT_RAW */
+    atomic_t mmap_count;            /* live mappings pin the current ring */
+    struct circ_buffer_stats stats_base; /* totals of rings replaced by a resize */
+};
+
+/* Character device variables */
+static int major;
+static struct class *wii_class;
+static DEFINE_IDA(wii_minors);
+static struct proc_dir_entry *wii_proc_dir;
+static struct dentry *wii_debugfs_dir;
+
+/*
+ * /dev/wii_remote_all. Each remote feeds it through a ring of its own, so
+ * producers stay single and lock-free; the one open file merges the rings
+ * when it reads. wii_all_lock covers the remotes table, the source list and
+ * the reader's consumption of the rings; the list is also walked under RCU
+ * by poll() and the wait condition.
+ */
+struct wii_all_source {
+    struct list_head node;          /* on wii_all_sources */
+    struct wii_remote *remote;      /* holds a reference on remote->dev */
+    struct circ_buffer *ring;       /* remote->all_ring */
+};
+
+static DEFINE_MUTEX(wii_all_lock);
+static struct wii_remote *wii_remotes[WII_MAX_REMOTES];    /* connected, by index */
+static LIST_HEAD(wii_all_sources);
+static DECLARE_WAIT_QUEUE_HEAD(wii_all_wait);
+static bool wii_all_opened;
+static struct cdev wii_all_cdev;
+static struct device *wii_all_dev;
+
+
+/* The reader's current ring, for callers holding its read_lock */
+static struct circ_buffer *wii_ring(struct wii_reader *reader)
+{
+    return rcu_dereference_protected(reader->ring, lockdep_is_held(&reader->read_lock));
+}
+
+static bool wii_ring_empty(struct wii_reader *reader)
+{
+    bool empty;
+
+    rcu_read_lock();
+    empty = circ_buffer_empty(rcu_dereference(reader->ring));
+    rcu_read_unlock();
+    return empty;
+}
+
+/* Clamp a requested buffer size into range and round it up to a power of two */
+static unsigned int wii_ring_size(unsigned int size)
+{
+    return roundup_pow_of_two(clamp_t(unsigned int, size, CIRC_BUFFER_MIN_SIZE,
+                                      CIRC_BUFFER_MAX_SIZE));
+}
+
+/* Per-CPU counter updates, which compile to nothing without CONFIG_WII_REMOTE_STATS */
+#define wii_stat_add(remote, field, n)                              \
+    do {                                                            \
+        if (IS_ENABLED(CONFIG_WII_REMOTE_STATS))                    \
+            this_cpu_add((remote)->pstats->field, n);               \
+    } while (0)
+#define wii_stat_inc(remote, field) wii_stat_add(remote, field, 1)
+
+/* Record size of a reader's ring in the given format */
+static unsigned int wii_record_size(struct wii_remote *remote, bool raw)
+{
+    BUILD_BUG_ON(sizeof(struct wii_raw_report) == sizeof(struct wii_event));
+    return raw ? sizeof(struct wii_raw_report) : remote->record_size;
+}
+
+/*
+ * Copy one record to every reader whose ring holds records of record_size.
+ * Whole records only; a reader whose ring is full loses it on its own and the
+ * others are not held back.
+ */
+static void wii_fan_out(struct wii_remote *remote, unsigned int record_size,
+                        const char *data, size_t len)
+{
+    struct wii_reader *reader;
+    struct circ_buffer *ring;
+    size_t written = 0;
+
+    rcu_read_lock();
+    list_for_each_entry_rcu(reader, &remote->readers, node) {
+        ring = rcu_dereference(reader->ring);
+        if (ring->record_size == record_size)
+            written += circ_buffer_write(ring, data, len);
+    }
+    rcu_read_unlock();
+    wii_stat_add(remote, bytes_enqueued, written);
+}
+
+/* Queue a decoded event (or text line) for the readers that want events */
+static void wii_buffer_write(struct wii_remote *remote, const char *data, size_t len)
+{
+    struct circ_buffer *ring;
+    size_t written = 0;
+
+    wii_fan_out(remote, remote->record_size, data, len);
+
+    rcu_read_lock();
+    ring = rcu_dereference(remote->all_ring);
+    if (ring)
+        written = circ_buffer_write(ring, data, len);
+    rcu_read_unlock();
+    wii_stat_add(remote, bytes_enqueued, written);
+}
+
+/* Count the time since start_ns in hist */
+static void wii_hist_add(unsigned long __percpu *hist, u64 start_ns)
+{
+    unsigned int bucket;
+
+    if (!IS_ENABLED(CONFIG_WII_REMOTE_STATS))
+        return;
+    bucket = fls64(div_u64(ktime_get_ns() - start_ns, NSEC_PER_USEC));
+    this_cpu_inc(hist[min_t(unsigned int, bucket, WII_HIST_BUCKETS - 1)]);
+}
+
+/* Totals over all CPUs; reads race with updates but each counter is a word */
+static void wii_sum_stats(struct wii_remote *remote, struct wii_pcpu_stats *sum)
+{
+    unsigned long *total = (unsigned long *)sum;
+    const unsigned long *p;
+    int cpu, i;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu) {
+        p = (const unsigned long *)per_cpu_ptr(remote->pstats, cpu);
+        for (i = 0; i < sizeof(*sum) / sizeof(unsigned long); i++)
+            total[i] += READ_ONCE(p[i]);
+    }
+}
+
+/* Consistent copy of the status snapshot without blocking its writers */
+static void wii_get_status(struct wii_remote *remote, struct wii_status *status)
+{
+    unsigned int seq;
+    u64 status_ns;
+
+    do {
+        seq = read_seqbegin(&remote->status_lock);
+        *status = remote->status;
+        status_ns = remote->status_ns;
+    } while (read_seqretry(&remote->status_lock, seq));
+
+    status->age_ns = status_ns ? ktime_get_ns() - status_ns : U64_MAX;
+    status->ir_state = READ_ONCE(remote->ir_state);
+}
+
+/* Text names and input key codes, the latter matching the in-tree hid-wiimote */
+static const struct {
+    u16 mask;
+    const char *name;
+    unsigned int code;
+} wii_buttons[] = {
+    { WII_BTN_DPAD_RIGHT, "Dpad_Right", KEY_RIGHT },
+    { WII_BTN_DPAD_LEFT,  "Dpad_Left",  KEY_LEFT },
+    { WII_BTN_DPAD_DOWN,  "Dpad_Down",  KEY_DOWN },
+    { WII_BTN_DPAD_UP,    "Dpad_Up",    KEY_UP },
+    { WII_BTN_PLUS,       "Plus",       KEY_NEXT },
+    { WII_BTN_MINUS,      "Minus",      KEY_PREVIOUS },
+    { WII_BTN_HOME,       "Home",       BTN_MODE },
+    { WII_BTN_A,          "A",          BTN_A },
+    { WII_BTN_B,          "B",          BTN_B },
+    { WII_BTN_ONE,        "1",          BTN_1 },
+    { WII_BTN_TWO,        "2",          BTN_2 },
+};
+
+/*
+ * perform_text_mapping - write a decoded event as a human-readable string
+ * into the circular buffer. Only used when the text_events parameter is set.
+ */
+static void perform_text_mapping(struct wii_remote *remote, const struct wii_event *ev)
+{
+    char mapping_output[256];
+    int len = 0;
+    int i;
+
+    if (ev->flags & WII_EVENT_F_BATTERY) {
+        len = snprintf(mapping_output, sizeof(mapping_output), "Battery: %d\n", ev->battery);
+        wii_buffer_write(remote, mapping_output, len);
+        return;
+    }
+
+    len += snprintf(mapping_output + len, sizeof(mapping_output) - len,
+                    "Report: ID=%u, ", ev->report_id);
 
-/* IOCTL command to request a battery/status update */
-#define WIIMOTE_IOCTL_REQUEST_STATUS _IO('W', 1)
+    for (i = 0; i < ARRAY_SIZE(wii_buttons); i++) {
+        if (ev->buttons & wii_buttons[i].mask)
+            len += snprintf(mapping_output + len, sizeof(mapping_output) - len,
+                            "%s ", wii_buttons[i].name);
+    }
+
+    if (len == 0)
+        len = snprintf(mapping_output, sizeof(mapping_output), "No buttons pressed");
+
+    if (len < sizeof(mapping_output) - 1) {
+        mapping_output[len++] = '\n';
+        mapping_output[len] = '\0';
+    }
+
+    wii_buffer_write(remote, mapping_output, len);
+}
+
+/*
+ * wii_report_input - forward a decoded event to the input device, closed by a
+ * single input_sync(). The input core already drops values that did not
+ * change, so this runs before wii_filter_event() and sees every report.
+ */
+static void wii_report_input(struct wii_remote *remote, const struct wii_event *ev)
+{
+    struct input_dev *input = remote->input;
+    int i;
+
+    if (!input)
+        return;
+
+    if (ev->flags & WII_EVENT_F_BUTTONS)
+        for (i = 0; i < ARRAY_SIZE(wii_buttons); i++)
+            input_report_key(input, wii_buttons[i].code, ev->buttons & wii_buttons[i].mask);
+
+    if (ev->flags & WII_EVENT_F_ACCEL) {
+        input_report_abs(input, ABS_RX, ev->accel[0]);
+        input_report_abs(input, ABS_RY, ev->accel[1]);
+        input_report_abs(input, ABS_RZ, ev->accel[2]);
+    }
+
+    /* Untracked dots read 0x3ff on both axes, as with hid-wiimote */
+    if (ev->flags & WII_EVENT_F_IR)
+        for (i = 0; i < WII_IR_DOTS; i++) {
+            input_report_abs(input, ABS_HAT0X + 2 * i, ev->ir[i].x);
+            input_report_abs(input, ABS_HAT0Y + 2 * i, ev->ir[i].y);
+        }
+
+    input_sync(input);
+}
+
+/* Ask idle_work for a new throttling level; cheap enough to call per report */
+static void wii_idle_request(struct wii_remote *remote, u8 level)
+{
+    if (READ_ONCE(remote->idle) == level && READ_ONCE(remote->idle_target) == level)
+        return;
+    WRITE_ONCE(remote->idle_target, level);
+    schedule_work(&remote->idle_work);
+}
+
+/* An open file, or the input device with input_users; each also counts as activity */
+static void wii_user_get(struct wii_remote *remote)
+{
+    WRITE_ONCE(remote->active_ns, ktime_get_ns());
+    atomic_inc(&remote->users);
+    wii_idle_request(remote, WII_IDLE_ACTIVE);
+}
+
+static void wii_user_put(struct wii_remote *remote)
+{
+    if (atomic_dec_and_test(&remote->users) && READ_ONCE(power_save))
+        wii_idle_request(remote, WII_IDLE_UNUSED);
+}
+
+/*
+ * The input core only calls open for the first handle and close for the
+ * last, so the input device counts as one user however many clients it has.
+ */
+static int wii_input_open(struct input_dev *input)
+{
+    wii_user_get(input_get_drvdata(input));
+    return 0;
+}
+
+static void wii_input_close(struct input_dev *input)
+{
+    wii_user_put(input_get_drvdata(input));
+}
+
+/* wii_input_register - create the evdev node reporting what wii_report_input() sends */
+static int wii_input_register(struct wii_remote *remote, struct hid_device *hdev)
+{
+    struct input_dev *input;
+    int i, ret;
+
+    input = input_allocate_device();
+    if (!input)
+        return -ENOMEM;
+
+    input->name = "Nintendo Wii Remote";
+    input->phys = hdev->phys;
+    input->uniq = hdev->uniq;
+    input->id.bustype = hdev->bus;
+    input->id.vendor = hdev->vendor;
+    input->id.product = hdev->product;
+    input->id.version = hdev->version;
+    input->dev.parent = &hdev->dev;
+    if (input_users) {
+        input->open = wii_input_open;
+        input->close = wii_input_close;
+        input_set_drvdata(input, remote);
+    }
+
+    for (i = 0; i < ARRAY_SIZE(wii_buttons); i++)
+        input_set_capability(input, EV_KEY, wii_buttons[i].code);
+
+    /* 10-bit accelerometer, uncalibrated */
+    input_set_abs_params(input, ABS_RX, 0, 1023, 2, 4);
+    input_set_abs_params(input, ABS_RY, 0, 1023, 2, 4);
+    input_set_abs_params(input, ABS_RZ, 0, 1023, 2, 4);
+
+    /* One hat pair per IR dot, in camera pixels */
+    for (i = 0; i < WII_IR_DOTS; i++) {
+        input_set_abs_params(input, ABS_HAT0X + 2 * i, 0, 1023, 2, 4);
+        input_set_abs_params(input, ABS_HAT0Y + 2 * i, 0, 1023, 2, 4);
+    }
+
+    ret = input_register_device(input);
+    if (ret) {
+        input_free_device(input);
+        return ret;
+    }
+    remote->input = input;
+    return 0;
+}
+
+#define WII_EVENT_F_MOTION (WII_EVENT_F_ACCEL | WII_EVENT_F_IR | WII_EVENT_F_EXT)
+
+/*
+ * wii_filter_event - decide whether a decoded event is worth queuing.
+ *
+ * Button edges always are. Otherwise, with button_edges set, a report that
+ * only repeats the current state is dropped, and so is a motion sample
+ * identical to the last one queued. motion_coalesce_us further thins motion
+ * samples to at most one per interval.
+ */
+static bool wii_filter_event(struct wii_remote *remote, struct wii_event *ev)
+{
+    const struct wii_event *last = &remote->last_motion;
+    unsigned int interval_us = READ_ONCE(motion_coalesce_us);
+
+    if (ev->flags & WII_EVENT_F_BUTTONS) {
+        ev->changed = ev->buttons ^ remote->last_buttons;
+        remote->last_buttons = ev->buttons;
+    }
+    /* Status reports are rare and always answer something */
+    if (ev->changed || (ev->flags & WII_EVENT_F_BATTERY))
+        goto queue;
+
+    if (!(ev->flags & WII_EVENT_F_MOTION))
+        return !READ_ONCE(button_edges);
+
+    if (READ_ONCE(button_edges) && ev->flags == last->flags &&
+        !memcmp(ev->accel, last->accel, sizeof(ev->accel)) &&
+        !memcmp(ev->ir, last->ir, sizeof(ev->ir)) &&
+        ev->ext_len == last->ext_len && !memcmp(ev->ext, last->ext, ev->ext_len))
+        return false;
+
+    if (interval_us && ev->timestamp_ns - last->timestamp_ns < interval_us * NSEC_PER_USEC)
+        return false;
+
+queue:
+    if (ev->flags & WII_EVENT_F_MOTION)
+        remote->last_motion = *ev;
+    return true;
+}
+
+/*
+ * wii_idle_update - follow stillness from decoded events. A button change or
+ * an accelerometer axis moving more than idle_motion from where it settled
+ * is motion and lifts WII_IDLE_STILL; idle_timeout_ms without it, with the
+ * stream continuous and someone listening, turns continuous reporting off.
+ */
+static void wii_idle_update(struct wii_remote *remote, const struct wii_event *ev)
+{
+    unsigned int timeout_ms = READ_ONCE(idle_timeout_ms);
+    unsigned int threshold = READ_ONCE(idle_motion);
+    bool moved = false;
+    u64 since;
+    int i;
+
+    if ((ev->flags & WII_EVENT_F_BUTTONS) && ev->buttons != remote->last_buttons)
+        moved = true;
+    if (ev->flags & WII_EVENT_F_ACCEL)
+        for (i = 0; i < 3; i++)
+            if (abs(ev->accel[i] - remote->still_accel[i]) > threshold)
+                moved = true;
+
+    if (moved) {
+        memcpy(remote->still_accel, ev->accel, sizeof(remote->still_accel));
+        remote->still_ns = ev->timestamp_ns;
+        if (READ_ONCE(remote->idle) == WII_IDLE_STILL)
+            wii_idle_request(remote, WII_IDLE_ACTIVE);
+        return;
+    }
+
+    if (!READ_ONCE(power_save) || !timeout_ms || !(ev->flags & WII_EVENT_F_ACCEL) ||
+        READ_ONCE(remote->idle) != WII_IDLE_ACTIVE || !READ_ONCE(remote->req_continuous))
+        return;
+    since = max(remote->still_ns, READ_ONCE(remote->active_ns));
+    /* An open may postdate the report, hence signed */
+    if ((s64)(ev->timestamp_ns - since) >= (s64)timeout_ms * NSEC_PER_MSEC)
+        wii_idle_request(remote, WII_IDLE_STILL);
+}
+
+/*
+ * perform_input_mapping - decode a report into one struct wii_event and
+ * write it to the circular buffer as a single binary record. timestamp_ns is
+ * the receive time taken on entry to wii_raw_event().
+ */
+static void perform_input_mapping(struct wii_remote *remote, const u8 *data, int size,
+                                  u64 timestamp_ns)
+{
+    struct wii_event ev;
+    unsigned long flags;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.timestamp_ns = timestamp_ns;
+    ev.remote = remote->index;
+    if (!wii_decode_report(&remote->decode, data, size, &ev))
+        return;
+    wii_report_input(remote, &ev);
+    wii_idle_update(remote, &ev);
+
+    /* Buttons are only written here, so the unlocked comparison is safe */
+    if ((ev.flags & WII_EVENT_F_BUTTONS) && ev.buttons != remote->status.buttons) {
+        write_seqlock_irqsave(&remote->status_lock, flags);
+        remote->status.buttons = ev.buttons;
+        write_sequnlock_irqrestore(&remote->status_lock, flags);
+    }
+    if (!wii_filter_event(remote, &ev))
+        return;
+    if (IS_ENABLED(CONFIG_WII_REMOTE_DERIVED) && READ_ONCE(derived_data))
+        wii_derive_event(&remote->calib, &ev);
+
+    if (IS_ENABLED(CONFIG_WII_REMOTE_TEXT) && text_events)
+        perform_text_mapping(remote, &ev);
+    else
+        wii_buffer_write(remote, (const char *)&ev, sizeof(ev));
+}
 
-/*  circular buffer for mapped output */
-static char circ_buffer[CIRC_BUFFER_SIZE];
-static int head = 0, tail = 0;
-static DEFINE_MUTEX(circ_mutex);
+/* Character device file operations */
+/*
+ * device_open - give the new file its own ring and start copying events to it.
+ * Events that arrived before the open are not replayed.
+ */
+static int device_open(struct inode *inode, struct file *file)
+{
+    struct wii_remote *remote = container_of(inode->i_cdev, struct wii_remote, cdev);
+    struct wii_reader *reader;
+    struct circ_buffer *ring;
+
+    reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+    if (!reader)
+        return -ENOMEM;
+
+    reader->remote = remote;
+    mutex_init(&reader->read_lock);
+    init_waitqueue_head(&reader->read_wait);
+
+    ring = circ_buffer_create(wii_ring_size(ring_size), wii_record_size(remote, false),
+                              &reader->read_wait);
+    if (IS_ERR(ring)) {
+        kfree(reader);
+        return PTR_ERR(ring);
+    }
+    RCU_INIT_POINTER(reader->ring, ring);
+    if (drop_policy == WII_DROP_OLDEST && remote->record_size) {
+        circ_buffer_set_overwrite(ring, true);
+        reader->overwrite = true;
+    }
+
+    mutex_lock(&remote->readers_lock);
+    list_add_tail_rcu(&reader->node, &remote->readers);
+    mutex_unlock(&remote->readers_lock);
+    wii_user_get(remote);
+
+    file->private_data = reader;
+    return 0;
+}
+
+static int device_release(struct inode *inode, struct file *file)
+{
+    struct wii_reader *reader = file->private_data;
+    struct wii_remote *remote = reader->remote;
+
+    mutex_lock(&remote->readers_lock);
+    list_del_rcu(&reader->node);
+    mutex_unlock(&remote->readers_lock);
+    wii_user_put(remote);
+
+    /* Wait for wii_raw_event() to finish with this reader's ring */
+    synchronize_rcu();
+
+    circ_buffer_destroy(rcu_dereference_protected(reader->ring, true));
+    kfree(reader);
+    return 0;
+}
+
+/* timestamp_ns of the record at pos, which may straddle the wrap point */
+static u64 wii_record_timestamp(struct circ_buffer *ring, unsigned int pos)
+{
+    const char *src;
+    size_t n;
+    u64 ts;
+
+    BUILD_BUG_ON(offsetof(struct wii_event, timestamp_ns) != 0);
+    BUILD_BUG_ON(offsetof(struct wii_raw_report, timestamp_ns) != 0);
+    n = min(circ_buffer_peek(ring, pos, &src), sizeof(ts));
+    memcpy(&ts, src, n);
+    if (n < sizeof(ts)) {
+        circ_buffer_peek(ring, pos + n, &src);
+        memcpy((char *)&ts + n, src, sizeof(ts) - n);
+    }
+    return ts;
+}
 
-/* pointer to the HID device instance */
-static struct hid_device *wii_hid_dev = NULL;
+/*
+ * wii_ring_copy - move up to count bytes from ring to buf, rounded down to
+ * whole records. The caller serialises consumers of ring. Returns the bytes
+ * copied, -EINVAL if count cannot hold a record, or -EFAULT; if oldest_ns is
+ * given, it gets the timestamp of the first record copied.
+ */
+static ssize_t wii_ring_copy(struct circ_buffer *ring, char __user *buf, size_t count,
+                             u64 *oldest_ns)
+{
+    size_t bytes_copied;
+    unsigned int tail, pos;
+    const char *src;
+    size_t chunk;
+    int pass;
 
+    if (ring->record_size) {
+        if (count < ring->record_size)
+            return -EINVAL;
+        count = rounddown(count, ring->record_size);
+    }
 
-static int wii_connected = 0;     /* 1 if connected, 0 if not */
-static int wii_last_battery = -1; /* -1 means unknown */
-static struct proc_dir_entry *wii_proc_entry;
+    /* Redone from the new tail if the producer overwrote what we copied */
+    do {
+        tail = circ_buffer_read_begin(ring);
+        pos = tail;
+        bytes_copied = 0;
+        /* At most two contiguous copies: up to the wrap point, then from the start */
+        for (pass = 0; pass < 2 && bytes_copied < count; pass++) {
+            chunk = min(circ_buffer_peek(ring, pos, &src), count - bytes_copied);
+            if (!chunk)
+                break;
+            if (copy_to_user(buf + bytes_copied, src, chunk))
+                return -EFAULT;
+            pos += chunk;
+            bytes_copied += chunk;
+        }
+        /* Covered by the commit: if the producer overwrote it, this runs again */
+        if (oldest_ns && bytes_copied && ring->record_size)
+            *oldest_ns = wii_record_timestamp(ring, tail);
+    } while (!circ_buffer_read_commit(ring, tail, pos));
+
+    return bytes_copied;
+}
+
+/* wii_ring_copy() from the reader's ring, with read_lock held */
+static ssize_t wii_reader_copy(struct wii_reader *reader, char __user *buf, size_t count)
+{
+    struct wii_remote *remote = reader->remote;
+    u64 oldest_ns = 0;
+    ssize_t ret;
+
+    ret = wii_ring_copy(wii_ring(reader), buf, count,
+                        IS_ENABLED(CONFIG_WII_REMOTE_STATS) ? &oldest_ns : NULL);
+    if (ret <= 0)
+        return ret;
+
+    wii_stat_add(remote, bytes_read, ret);
+    if (oldest_ns)
+        wii_hist_add(remote->pstats->latency_hist, oldest_ns);
+    return ret;
+}
+
+/*
+ * device_read - copy queued output to user space.
+ *
+ * Blocks until the HID callback queues something unless the file was opened
+ * with O_NONBLOCK, in which case an empty buffer returns -EAGAIN. Once the
+ * remote has gone away and the buffer is drained, reads fail with -ENODEV.
+ * Binary records are only returned whole, so count must hold at least one.
+ */
+static ssize_t device_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+    struct wii_reader *reader = file->private_data;
+    struct wii_remote *remote = reader->remote;
+    ssize_t ret = 0;
+
+    if (!count)
+        return 0;
+
+    while (!ret) {
+        if (wii_ring_empty(reader)) {
+            if (!READ_ONCE(remote->connected))
+                return -ENODEV;
+            if (file->f_flags & O_NONBLOCK)
+                return -EAGAIN;
+            if (wait_event_interruptible(reader->read_wait, !wii_ring_empty(reader) ||
+                                         !READ_ONCE(remote->connected)))
+                return -ERESTARTSYS;
+        }
+
+        mutex_lock(&reader->read_lock);
+        ret = wii_reader_copy(reader, buf, count);
+        mutex_unlock(&reader->read_lock);
+        /* A thread sharing this file may have drained it first; go back to waiting */
+    }
+    return ret;
+}
+
+/* True once min_bytes are queued, or as many whole records as the ring holds */
+static bool wii_batch_ready(struct wii_reader *reader, size_t min_bytes)
+{
+    struct circ_buffer *ring;
+    bool ready;
+
+    rcu_read_lock();
+    ring = rcu_dereference(reader->ring);
+    /* A text ring swapped in by SET_FORMAT ends the wait; the caller refuses it */
+    ready = !ring->record_size ||
+            circ_buffer_queued(ring) >= min_t(size_t, min_bytes,
+                                              rounddown(ring->size, ring->record_size));
+    rcu_read_unlock();
+    return ready;
+}
+
+/*
+ * wii_read_batch - WIIMOTE_IOCTL_READ_BATCH: wait until min_count records are
+ * queued or the timeout expires, then copy out as many as there are, up to
+ * count. Binary records only. An interrupted wait returns -EINTR rather than
+ * restarting, which would start the timeout over.
+ */
+static int wii_read_batch(struct file *file, struct wii_read_batch *batch)
+{
+    struct wii_reader *reader = file->private_data;
+    struct wii_remote *remote = reader->remote;
+    unsigned int record_size = wii_record_size(remote, READ_ONCE(reader->raw));
+    unsigned int count, min_count;
+    long timeout;
+    ssize_t ret;
+
+    if (!record_size || !batch->count)
+        return -EINVAL;
+
+    /* No ring holds more than this, and it keeps count * record_size in range */
+    count = min_t(u32, batch->count, CIRC_BUFFER_MAX_SIZE / record_size);
+    min_count = clamp_t(u32, batch->min_count, 1, count);
+
+    if (file->f_flags & O_NONBLOCK || !batch->timeout_ms)
+        timeout = 0;
+    else if (batch->timeout_ms < 0)
+        timeout = MAX_SCHEDULE_TIMEOUT;
+    else
+        timeout = msecs_to_jiffies(batch->timeout_ms);
+
+    if (timeout) {
+        ret = wait_event_interruptible_timeout(reader->read_wait,
+                                               wii_batch_ready(reader, min_count * record_size) ||
+                                               !READ_ONCE(remote->connected), timeout);
+        if (ret < 0)
+            return -EINTR;
+    }
+
+    mutex_lock(&reader->read_lock);
+    /* The format may have changed while we waited */
+    if (wii_ring(reader)->record_size != record_size)
+        ret = -EINVAL;
+    else
+        ret = wii_reader_copy(reader, u64_to_user_ptr(batch->buf), count * record_size);
+    mutex_unlock(&reader->read_lock);
+    if (ret < 0)
+        return ret;
+    if (!ret && !READ_ONCE(remote->connected))
+        return -ENODEV;
+
+    batch->returned = ret / record_size;
+    return 0;
+}
+
+/* Track mappings so the ring they point at is not resized away underneath them */
+static void wii_vma_open(struct vm_area_struct *vma)
+{
+    struct wii_reader *reader = vma->vm_private_data;
+
+    atomic_inc(&reader->mmap_count);
+}
+
+static void wii_vma_close(struct vm_area_struct *vma)
+{
+    struct wii_reader *reader = vma->vm_private_data;
+
+    atomic_dec(&reader->mmap_count);
+}
+
+static const struct vm_operations_struct wii_vm_ops = {
+    .open  = wii_vma_open,
+    .close = wii_vma_close,
+};
+
+/*
+ * device_mmap - map the ring header and data for syscall-free consumption.
+ * See struct wii_ring_header in wii-remote.h for the protocol.
+ */
+static int device_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct wii_reader *reader = file->private_data;
+    int ret;
+
+    mutex_lock(&reader->read_lock);
+    ret = circ_buffer_mmap(wii_ring(reader), vma);
+    if (!ret) {
+        vma->vm_ops = &wii_vm_ops;
+        vma->vm_private_data = reader;
+        wii_vma_open(vma);
+    }
+    mutex_unlock(&reader->read_lock);
+    return ret;
+}
+
+static __poll_t device_poll(struct file *file, poll_table *wait)
+{
+    struct wii_reader *reader = file->private_data;
+    struct wii_remote *remote = reader->remote;
+    __poll_t mask = 0;
+
+    poll_wait(file, &reader->read_wait, wait);
+
+    if (!wii_ring_empty(reader))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (!READ_ONCE(remote->connected))
+        mask |= EPOLLHUP | EPOLLERR;
+    return mask;
+}
+
+/* Counters of the current ring plus those it replaced; called with read_lock held */
+static void wii_get_ring_stats(struct wii_reader *reader, struct wii_ring_stats *stats)
+{
+    struct circ_buffer *ring = wii_ring(reader);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->enqueued = reader->stats_base.enqueued + READ_ONCE(ring->stats.enqueued);
+    stats->dropped = reader->stats_base.dropped + READ_ONCE(ring->stats.dropped);
+    stats->overwritten = reader->stats_base.overwritten + READ_ONCE(ring->stats.overwritten);
+    stats->high_water = READ_ONCE(ring->stats.high_water);
+    stats->size = ring->size;
+}
+
+/*
+ * wii_replace_ring - give the reader a new ring of size bytes in the given
+ * format. Called with read_lock held.
+ *
+ * Binary records still queued in the old ring are discarded and counted as
+ * dropped. Refused while the ring is mapped, since the mapping would keep
+ * pointing at the old memory.
+ */
+static int wii_replace_ring(struct wii_reader *reader, unsigned int size, bool raw)
+{
+    struct circ_buffer *old, *new;
+    unsigned int queued;
+
+    lockdep_assert_held(&reader->read_lock);
+    if (atomic_read(&reader->mmap_count))
+        return -EBUSY;
+
+    new = circ_buffer_create(size, wii_record_size(reader->remote, raw), &reader->read_wait);
+    if (IS_ERR(new))
+        return PTR_ERR(new);
+    /* Text rings cannot overwrite; the policy falls back to dropping newest */
+    if (reader->overwrite && circ_buffer_set_overwrite(new, true))
+        reader->overwrite = false;
+
+    old = wii_ring(reader);
+    rcu_assign_pointer(reader->ring, new);
+    reader->raw = raw;
+    /* Wait for the producers to stop writing into the old ring */
+    synchronize_rcu();
+
+    queued = READ_ONCE(old->hdr->head) - READ_ONCE(old->hdr->tail);
+    reader->stats_base.enqueued += old->stats.enqueued;
+    reader->stats_base.dropped += old->stats.dropped;
+    if (old->record_size)
+        reader->stats_base.dropped += min(queued, old->size) / old->record_size;
+    reader->stats_base.overwritten += old->stats.overwritten;
+
+    circ_buffer_destroy(old);
+    return 0;
+}
+
+/*
+ * Reports whose whole effect is the state they carry, so that a newer one
+ * makes a pending older one pointless. Memory reads and writes (0x16, 0x17)
+ * and speaker data (0x18) are always sent one by one.
+ */
+static bool wii_output_coalesces(u8 report_id)
+{
+    switch (report_id) {
+    case 0x10:      /* rumble */
+    case 0x11:      /* player LEDs */
+    case 0x12:      /* data reporting mode */
+    case 0x13:      /* IR camera clock */
+    case 0x14:      /* speaker enable */
+    case 0x15:      /* status request */
+    case 0x19:      /* speaker mute */
+    case 0x1a:      /* IR camera enable */
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Reports the remote answers with a 0x22: register writes always, anything
+ * else when asked to. wii_output_ack() counts those answers, so such a
+ * report is never merged with another one.
+ */
+static bool wii_output_acked(const u8 *data, size_t len)
+{
+    return data[0] == 0x16 || (len > 1 && (data[1] & WII_OUT_ACK_REQUEST));
+}
+
+/*
+ * __wii_queue_output - queue an output report for out_work, with out_lock held.
+ *
+ * A coalescing report overwrites a pending one with the same ID in place, so
+ * it keeps that report's position in the queue. Returns -EAGAIN when the
+ * queue is full and -ENODEV after disconnect.
+ */
+static int __wii_queue_output(struct wii_remote *remote, const u8 *data, size_t len)
+{
+    struct wii_output *out;
+    unsigned int i;
+
+    lockdep_assert_held(&remote->out_lock);
+    if (WARN_ON(!len || len > WII_OUT_MAX_LEN))
+        return -EINVAL;
+    if (remote->out_closed)
+        return -ENODEV;
+
+    if (wii_output_coalesces(data[0]) && !wii_output_acked(data, len)) {
+        for (i = remote->out_tail; i != remote->out_head; i++) {
+            out = &remote->out_queue[i & (WII_OUT_QUEUE_LEN - 1)];
+            if (out->data[0] == data[0] && !wii_output_acked(out->data, out->len)) {
+                memcpy(out->data, data, len);
+                out->len = len;
+                remote->out_coalesced++;
+                return 0;
+            }
+        }
+    }
+
+    if (remote->out_head - remote->out_tail == WII_OUT_QUEUE_LEN)
+        return -EAGAIN;
+    out = &remote->out_queue[remote->out_head++ & (WII_OUT_QUEUE_LEN - 1)];
+    memcpy(out->data, data, len);
+    out->len = len;
+    schedule_work(&remote->out_work);
+    return 0;
+}
+
+/* wii_queue_output - queue an output report and return at once; safe from any context */
+static int wii_queue_output(struct wii_remote *remote, const u8 *data, size_t len)
+{
+    unsigned long flags;
+    int ret;
+
+    spin_lock_irqsave(&remote->out_lock, flags);
+    ret = __wii_queue_output(remote, data, len);
+    spin_unlock_irqrestore(&remote->out_lock, flags);
+    return ret;
+}
+
+/* Record what a report that reached the remote changed. Called with lock held. */
+static void wii_output_sent(struct wii_remote *remote, const struct wii_output *out)
+{
+    unsigned long flags;
+
+    write_seqlock_irqsave(&remote->status_lock, flags);
+    switch (out->data[0]) {
+    case 0x11:
+        remote->status.leds = out->data[1] >> 4;
+        break;
+    case 0x12:
+        remote->status.report_mode = out->data[2];
+        remote->status.continuous = !!(out->data[1] & 0x04);
+        break;
+    }
+    write_sequnlock_irqrestore(&remote->status_lock, flags);
+}
+
+/* wii_output_work - send queued output reports until the queue is empty */
+static void wii_output_work(struct work_struct *work)
+{
+    struct wii_remote *remote = container_of(work, struct wii_remote, out_work);
+    struct wii_output out;
+    unsigned long flags;
+    int ret;
+
+    for (;;) {
+        spin_lock_irqsave(&remote->out_lock, flags);
+        if (remote->out_tail == remote->out_head) {
+            spin_unlock_irqrestore(&remote->out_lock, flags);
+            return;
+        }
+        out = remote->out_queue[remote->out_tail++ & (WII_OUT_QUEUE_LEN - 1)];
+        spin_unlock_irqrestore(&remote->out_lock, flags);
+
+        /* Every output report carries the rumble bit; sending it clear stops the motor */
+        if (out.len > 1)
+            out.data[1] = (out.data[1] & ~0x01) | READ_ONCE(remote->rumble);
+
+        mutex_lock(&remote->lock);
+        if (remote->hdev)
+            ret = hid_hw_raw_request(remote->hdev, out.data[0], out.data, out.len,
+                                     HID_OUTPUT_REPORT, HID_REQ_SET_REPORT);
+        else
+            ret = -ENODEV;
+        if (ret >= 0)
+            wii_output_sent(remote, &out);
+        mutex_unlock(&remote->lock);
+
+        if (ret < 0) {
+            WRITE_ONCE(remote->out_failed, remote->out_failed + 1);
+            printk_ratelimited(KERN_ERR DRIVER_NAME ": failed to send output report 0x%02x, error %d\n",
+                               out.data[0], ret);
+        } else {
+            WRITE_ONCE(remote->out_sent, remote->out_sent + 1);
+        }
+    }
+}
+
+/*
+ * __wii_queue_mode - queue output report 0x12 for mode, throttled to what
+ * idle allows. Called with out_lock held.
+ */
+static int __wii_queue_mode(struct wii_remote *remote, u8 idle, u8 mode, bool continuous)
+{
+    u8 request[3] = { 0x12, 0x00, mode };
+
+    if (idle == WII_IDLE_UNUSED)
+        request[2] = 0x30;
+    else if (idle == WII_IDLE_ACTIVE && continuous)
+        request[1] = 0x04;
+    return __wii_queue_output(remote, request, sizeof(request));
+}
+
+/*
+ * wii_set_report_mode - queue output report 0x12 selecting the data reporting
+ * mode, and remember it for wii_rearm_report_mode(). Counts as activity, so
+ * it lifts WII_IDLE_STILL.
+ */
+static int wii_set_report_mode(struct wii_remote *remote, u8 mode, bool continuous)
+{
+    unsigned long flags;
+    u8 idle;
+    int ret;
+
+    /* 0x3f is only ever sent by the remote as the second half of 0x3e */
+    if (mode < 0x30 || mode == 0x3f || !wii_report_layout(mode))
+        return -EINVAL;
+
+    WRITE_ONCE(remote->active_ns, ktime_get_ns());
+    spin_lock_irqsave(&remote->out_lock, flags);
+    idle = remote->idle == WII_IDLE_STILL ? WII_IDLE_ACTIVE : remote->idle;
+    ret = __wii_queue_mode(remote, idle, mode, continuous);
+    if (!ret) {
+        remote->req_mode = mode;
+        WRITE_ONCE(remote->req_continuous, continuous);
+        WRITE_ONCE(remote->idle, idle);
+    }
+    spin_unlock_irqrestore(&remote->out_lock, flags);
+    return ret;
+}
+
+/*
+ * wii_rearm_report_mode - send the requested mode again. After any status
+ * report the remote stops sending data reports until it gets a 0x12, which
+ * is how plugging or unplugging an extension stalls the stream. Built under
+ * out_lock so it can never replace a newer pending mode with an older one.
+ */
+static void wii_rearm_report_mode(struct wii_remote *remote)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&remote->out_lock, flags);
+    __wii_queue_mode(remote, remote->idle, remote->req_mode, remote->req_continuous);
+    spin_unlock_irqrestore(&remote->out_lock, flags);
+}
+
+/*
+ * wii_idle_work - switch to the throttling level last asked for and send the
+ * mode that goes with it. A level that could not be queued stays pending for
+ * the next request.
+ */
+static void wii_idle_work(struct work_struct *work)
+{
+    struct wii_remote *remote = container_of(work, struct wii_remote, idle_work);
+    u8 level = READ_ONCE(remote->idle_target);
+
+    /* A file opened while the last one was being released */
+    if (level == WII_IDLE_UNUSED && atomic_read(&remote->users))
+        level = WII_IDLE_ACTIVE;
+
+    spin_lock_irq(&remote->out_lock);
+    if (remote->idle != level &&
+        !__wii_queue_mode(remote, level, remote->req_mode, remote->req_continuous)) {
+        WRITE_ONCE(remote->idle, level);
+        remote->idle_changes++;
+    }
+    spin_unlock_irq(&remote->out_lock);
+}
+
+/*
+ * __wii_queue_feedback - bring the LEDs and rumble motor to the given state
+ * with as few output reports as possible: none if neither changed, else one
+ * 0x11 if the LEDs did, which carries the rumble bit as every report does,
+ * or one 0x10. Called with out_lock held.
+ */
+static int __wii_queue_feedback(struct wii_remote *remote, u8 leds, bool rumble)
+{
+    u8 request[2];
+    int ret;
+
+    lockdep_assert_held(&remote->out_lock);
+    if (leds != remote->leds) {
+        request[0] = 0x11;
+        request[1] = leds << 4;
+    } else if (rumble != remote->rumble) {
+        request[0] = 0x10;
+        request[1] = rumble;
+    } else {
+        return 0;
+    }
+
+    ret = __wii_queue_output(remote, request, sizeof(request));
+    if (ret)
+        return ret;
+    remote->leds = leds;
+    /* out_work reads it after taking the report off the queue */
+    WRITE_ONCE(remote->rumble, rumble);
+    return 0;
+}
+
+/* wii_set_leds - WIIMOTE_IOCTL_SET_LEDS: queue output report 0x11, changed or not */
+static int wii_set_leds(struct wii_remote *remote, u8 leds)
+{
+    u8 request[2] = { 0x11, leds << 4 };
+    unsigned long flags;
+    int ret;
+
+    spin_lock_irqsave(&remote->out_lock, flags);
+    ret = __wii_queue_output(remote, request, sizeof(request));
+    if (!ret)
+        remote->leds = leds;
+    spin_unlock_irqrestore(&remote->out_lock, flags);
+    return ret;
+}
+
+/*
+ * wii_pattern_tick - pattern_timer: set the state of the step the pattern is
+ * in now and sleep until that step ends, though never for less than
+ * WII_FEEDBACK_MIN_NS. Positions come from start_ns rather than from the
+ * previous tick, so late ticks neither drift nor replay missed steps. A
+ * pattern that has ended, or whose remote is gone, is freed here.
+ */
+static enum hrtimer_restart wii_pattern_tick(struct hrtimer *timer)
+{
+    struct wii_remote *remote = container_of(timer, struct wii_remote, pattern_timer);
+    enum hrtimer_restart restart = HRTIMER_NORESTART;
+    struct wii_pattern_play *play, *done = NULL;
+    u64 now = ktime_get_ns();
+    u64 elapsed, passes;
+    unsigned long flags;
+    unsigned int i;
+
+    spin_lock_irqsave(&remote->out_lock, flags);
+    play = remote->pattern;
+    if (!play)
+        goto unlock;
+
+    elapsed = now - play->start_ns;
+    if (elapsed >= play->length_ns) {
+        passes = div64_u64(elapsed, play->length_ns);
+        if (play->repeat && passes >= play->repeat - play->passes)
+            done = play;
+        else if (play->repeat)
+            play->passes += passes;
+        play->start_ns += passes * play->length_ns;
+        elapsed -= passes * play->length_ns;
+    }
+
+    /* A finished pattern stays at its last step, and so does a single one */
+    if (done || play->count == 1)
+        i = play->count - 1;
+    else
+        for (i = 0; elapsed >= play->steps[i].end_ns; i++)
+            ;
+    /* When the queue is full the state is simply set on the next tick */
+    if (__wii_queue_feedback(remote, play->steps[i].leds, play->steps[i].rumble) == -ENODEV ||
+        play->count == 1)
+        done = play;
+    remote->feedback_ns = now;
+
+    if (done) {
+        remote->pattern = NULL;
+    } else {
+        hrtimer_set_expires(timer, ns_to_ktime(max(play->start_ns + play->steps[i].end_ns,
+                                                   now + WII_FEEDBACK_MIN_NS)));
+        restart = HRTIMER_RESTART;
+    }
+unlock:
+    spin_unlock_irqrestore(&remote->out_lock, flags);
+    kfree(done);
+    return restart;
+}
+
+/* Stop the pattern playing, if any, leaving the LEDs and motor as they are */
+static void __wii_pattern_stop(struct wii_remote *remote)
+{
+    struct wii_pattern_play *play;
+    unsigned long flags;
+
+    lockdep_assert_held(&remote->pattern_lock);
+    spin_lock_irqsave(&remote->out_lock, flags);
+    play = remote->pattern;
+    remote->pattern = NULL;
+    spin_unlock_irqrestore(&remote->out_lock, flags);
+
+    /* A tick already running finds no pattern and does not restart */
+    hrtimer_cancel(&remote->pattern_timer);
+    kfree(play);
+}
+
+static void wii_pattern_stop(struct wii_remote *remote)
+{
+    mutex_lock(&remote->pattern_lock);
+    __wii_pattern_stop(remote);
+    mutex_unlock(&remote->pattern_lock);
+}
+
+/*
+ * wii_pattern_start - WIIMOTE_IOCTL_SET_PATTERN: replace the pattern playing,
+ * if any, with the one described by pattern. The first step is set at once,
+ * or as soon as the rate limit allows after the last change.
+ */
+static int wii_pattern_start(struct wii_remote *remote, const struct wii_pattern *pattern)
+{
+    struct wii_pattern_step __user *usteps = u64_to_user_ptr(pattern->steps);
+    struct wii_pattern_step step;
+    struct wii_pattern_play *play;
+    unsigned long flags;
+    unsigned int i, n = 0;
+    u64 end_ns = 0, now;
+    int ret = 0;
+
+    if (pattern->count > WII_PATTERN_MAX_STEPS)
+        return -EINVAL;
+    if (!pattern->count) {
+        wii_pattern_stop(remote);
+        return 0;
+    }
+
+    play = kzalloc(struct_size(play, steps, pattern->count), GFP_KERNEL);
+    if (!play)
+        return -ENOMEM;
+    for (i = 0; i < pattern->count; i++) {
+        if (copy_from_user(&step, &usteps[i], sizeof(step))) {
+            ret = -EFAULT;
+            goto out;
+        }
+        if (!step.duration_ms || (step.leds & ~WII_LED_ALL)) {
+            ret = -EINVAL;
+            goto out;
+        }
+        end_ns += (u64)step.duration_ms * NSEC_PER_MSEC;
+        /* Nothing would change at this step's start; let the previous one last */
+        if (n && play->steps[n - 1].leds == step.leds &&
+            play->steps[n - 1].rumble == !!step.rumble) {
+            play->steps[n - 1].end_ns = end_ns;
+            continue;
+        }
+        play->steps[n].end_ns = end_ns;
+        play->steps[n].leds = step.leds;
+        play->steps[n].rumble = !!step.rumble;
+        n++;
+    }
+    play->count = n;
+    play->repeat = pattern->repeat;
+    play->length_ns = end_ns;
+
+    mutex_lock(&remote->pattern_lock);
+    __wii_pattern_stop(remote);
+    spin_lock_irqsave(&remote->out_lock, flags);
+    if (remote->out_closed) {
+        ret = -ENODEV;
+    } else {
+        /* Armed under out_lock, so wii_quiesce() either sees it or we see out_closed */
+        now = ktime_get_ns();
+        play->start_ns = now;
+        remote->pattern = play;
+        play = NULL;
+        hrtimer_start(&remote->pattern_timer,
+                      ns_to_ktime(max(now, remote->feedback_ns + WII_FEEDBACK_MIN_NS)),
+                      HRTIMER_MODE_ABS_SOFT);
+    }
+    spin_unlock_irqrestore(&remote->out_lock, flags);
+    mutex_unlock(&remote->pattern_lock);
+out:
+    kfree(play);
+    return ret;
+}
+
+/* wii_read_memory - queue output report 0x17; the data comes back in 0x21 reports */
+static int wii_read_memory(struct wii_remote *remote, u8 space, u32 addr, u16 len)
+{
+    u8 request[7] = { 0x17, space, addr >> 16, addr >> 8, addr, len >> 8, len };
+
+    return wii_queue_output(remote, request, sizeof(request));
+}
+
+/* Fill in output report 0x16 writing len bytes to a register */
+static void wii_write_register(struct wii_output *out, u32 addr, const u8 *data, u8 len)
+{
+    memset(out->data, 0, sizeof(out->data));
+    out->data[0] = 0x16;
+    out->data[1] = WII_MEM_REGISTERS;
+    out->data[2] = addr >> 16;
+    out->data[3] = addr >> 8;
+    out->data[4] = addr;
+    out->data[5] = len;
+    memcpy(&out->data[WII_WRITE_DATA], data, len);
+    out->len = WII_WRITE_DATA + WII_WRITE_MAX_LEN;
+}
+
+/*
+ * wii_ir_start - set up the IR camera in mode (WII_IR_CAMERA_*), or turn it
+ * off. Every step of the sequence is queued at once, with acknowledgements
+ * requested, and wii_output_ack() follows them in order; ir_timeout fails
+ * the sequence if they stop coming. Returns -EBUSY while one is running, or
+ * while reports of one that failed are still queued, since their
+ * acknowledgements would be taken for the new steps; -EAGAIN when the output
+ * queue cannot take the whole sequence.
+ */
+static int wii_ir_start(struct wii_remote *remote, unsigned int mode, unsigned int sensitivity)
+{
+    /* Sensitivity blocks 1 and 2 for each level, as the Wii uses them */
+    static const u8 sens[5][WII_IR_SENS1_LEN + WII_IR_SENS2_LEN] = {
+        { 0x02, 0x00, 0x00, 0x71, 0x01, 0x00, 0x64, 0x00, 0xfe, 0xfd, 0x05 },
+        { 0x02, 0x00, 0x00, 0x71, 0x01, 0x00, 0x96, 0x00, 0xb4, 0xb3, 0x04 },
+        { 0x02, 0x00, 0x00, 0x71, 0x01, 0x00, 0xaa, 0x00, 0x64, 0x63, 0x03 },
+        { 0x02, 0x00, 0x00, 0x71, 0x01, 0x00, 0xc8, 0x00, 0x36, 0x35, 0x03 },
+        { 0x07, 0x00, 0x00, 0x71, 0x01, 0x00, 0x72, 0x00, 0x20, 0x1f, 0x03 },
+    };
+    static const u8 control = 0x08;
+    struct wii_output steps[WII_IR_MAX_STEPS];
+    struct wii_output *out;
+    u8 enable = mode ? WII_IR_ENABLE : 0;
+    unsigned long flags;
+    unsigned int i, n = 0;
+    const u8 *level;
+    u8 camera_mode = mode;
+    int ret = 0;
+
+    if ((mode != WII_IR_CAMERA_OFF && mode != WII_IR_CAMERA_BASIC &&
+         mode != WII_IR_CAMERA_EXTENDED && mode != WII_IR_CAMERA_FULL) || sensitivity > 5)
+        return -EINVAL;
+    level = sens[(sensitivity ? sensitivity : 3) - 1];
+
+    steps[n].data[0] = 0x13;
+    steps[n].data[1] = enable | WII_OUT_ACK_REQUEST;
+    steps[n++].len = 2;
+    steps[n].data[0] = 0x1a;
+    steps[n].data[1] = enable | WII_OUT_ACK_REQUEST;
+    steps[n++].len = 2;
+    if (mode) {
+        wii_write_register(&steps[n++], WII_IR_REG_CONTROL, &control, 1);
+        wii_write_register(&steps[n++], WII_IR_REG_SENS1, level, WII_IR_SENS1_LEN);
+        wii_write_register(&steps[n++], WII_IR_REG_SENS2, level + WII_IR_SENS1_LEN,
+                           WII_IR_SENS2_LEN);
+        wii_write_register(&steps[n++], WII_IR_REG_MODE, &camera_mode, 1);
+        wii_write_register(&steps[n++], WII_IR_REG_CONTROL, &control, 1);
+    }
+
+    spin_lock_irqsave(&remote->out_lock, flags);
+    if (remote->ir_state == WII_IR_STATE_BUSY)
+        ret = -EBUSY;
+    else if (remote->out_closed)
+        ret = -ENODEV;
+    else if (WII_OUT_QUEUE_LEN - (remote->out_head - remote->out_tail) < n)
+        ret = -EAGAIN;
+    /* Left over from a sequence that timed out */
+    for (i = remote->out_tail; !ret && i != remote->out_head; i++) {
+        out = &remote->out_queue[i & (WII_OUT_QUEUE_LEN - 1)];
+        if (wii_output_acked(out->data, out->len))
+            ret = -EBUSY;
+    }
+    if (!ret) {
+        /* There is room for all of them, so none of these can fail */
+        for (i = 0; i < n; i++) {
+            __wii_queue_output(remote, steps[i].data, steps[i].len);
+            remote->ir_acks[i] = steps[i].data[0];
+        }
+        remote->ir_mode = mode;
+        remote->ir_step = 0;
+        remote->ir_steps = n;
+        remote->ir_start_ns = ktime_get_ns();
+        WRITE_ONCE(remote->ir_state, WII_IR_STATE_BUSY);
+        mod_delayed_work(system_wq, &remote->ir_timeout, msecs_to_jiffies(WII_IR_TIMEOUT_MS));
+    }
+    spin_unlock_irqrestore(&remote->out_lock, flags);
+    return ret;
+}
+
+/*
+ * wii_output_ack - take in a 0x22 acknowledgement. Only the IR camera set-up
+ * asks for them; anything that is not the next step it waits for is ignored.
+ */
+static void wii_output_ack(struct wii_remote *remote, const u8 *data, int size)
+{
+    unsigned int step = 0;
+    unsigned long flags;
+    bool matched = false;
+    u64 elapsed_ns = 0;
+    u8 state, err = 0;
+
+    if (size <= WII_ACK_ERROR)
+        return;
+
+    spin_lock_irqsave(&remote->out_lock, flags);
+    state = remote->ir_state;
+    if (state == WII_IR_STATE_BUSY && data[WII_ACK_REPORT] == remote->ir_acks[remote->ir_step]) {
+        step = remote->ir_step;
+        err = data[WII_ACK_ERROR];
+        if (err)
+            state = WII_IR_STATE_FAILED;
+        else if (++remote->ir_step == remote->ir_steps)
+            state = remote->ir_mode ? WII_IR_STATE_READY : WII_IR_STATE_OFF;
+        WRITE_ONCE(remote->ir_state, state);
+        elapsed_ns = ktime_get_ns() - remote->ir_start_ns;
+        matched = true;
+    }
+    spin_unlock_irqrestore(&remote->out_lock, flags);
+
+    if (!matched || state == WII_IR_STATE_BUSY)
+        return;
+    cancel_delayed_work(&remote->ir_timeout);
+    if (err)
+        printk(KERN_WARNING DRIVER_NAME ": %s: IR camera set-up failed at step %u, error %u\n",
+               dev_name(&remote->dev), step + 1, err);
+    else
+        printk(KERN_INFO DRIVER_NAME ": %s: IR camera %s in %llu us\n", dev_name(&remote->dev),
+               state == WII_IR_STATE_READY ? "ready" : "off",
+               div_u64(elapsed_ns, NSEC_PER_USEC));
+}
+
+/* wii_ir_timeout - the remote stopped acknowledging the IR camera set-up */
+static void wii_ir_timeout(struct work_struct *work)
+{
+    struct wii_remote *remote = container_of(to_delayed_work(work), struct wii_remote,
+                                             ir_timeout);
+    unsigned int step = 0;
+    bool failed = false;
+
+    spin_lock_irq(&remote->out_lock);
+    if (remote->ir_state == WII_IR_STATE_BUSY) {
+        WRITE_ONCE(remote->ir_state, WII_IR_STATE_FAILED);
+        step = remote->ir_step;
+        failed = true;
+    }
+    spin_unlock_irq(&remote->out_lock);
+
+    if (failed)
+        printk(KERN_WARNING DRIVER_NAME ": %s: IR camera set-up timed out at step %u\n",
+               dev_name(&remote->dev), step + 1);
+}
+
+/* Unpack the EEPROM calibration block; false if it is corrupt */
+static bool wii_parse_calibration(const u8 *p, struct wii_calibration *calib)
+{
+    u8 sum = 0x55;
+    int i;
 
+    for (i = 0; i < WII_CALIB_LEN - 1; i++)
+        sum += p[i];
+    if (sum != p[WII_CALIB_LEN - 1])
+        return false;
 
-static void circ_buffer_write(const char *data, size_t len)
-{
-    size_t i;
-    mutex_lock(&circ_mutex);
-    for (i = 0; i < len; i++) {
-        int next = (head + 1) % CIRC_BUFFER_SIZE;
-        if (next == tail) {
-            printk(KERN_WARNING DRIVER_NAME ": circular buffer full, dropping data\n");
-            break;
-        }
-        circ_buffer[head] = data[i];
-        head = next;
+    for (i = 0; i < 3; i++) {
+        calib->zero[i] = (p[i] << 2) | ((p[3] >> (4 - 2 * i)) & 0x03);
+        calib->one_g[i] = (p[4 + i] << 2) | ((p[7] >> (4 - 2 * i)) & 0x03);
+        /* wii_derive_event() divides by the difference */
+        if (calib->one_g[i] < calib->zero[i] + WII_CALIB_MIN_RANGE)
+            return false;
     }
-    mutex_unlock(&circ_mutex);
+    return true;
 }
 
 /*
- * perform_input_mapping - this parses a button report and write a human-readable string
- * into the circular buffer.
- *
- * :
- *   Byte 0: Report ID.
- *   Byte 1: D-pad and special buttons:
- *            Bit 0: D-pad Right
- *            Bit 1: D-pad Left
- *            Bit 2: D-pad Down
- *            Bit 3: D-pad Up
- *            Bit 4: Plus Button
- *            Bit 5: Minus Button
- *            Bit 6: Home Button
- *   Byte 2: Action buttons:
- *            Bit 0: A Button
- *            Bit 1: B Button
- *            Bit 2: Button 1
- *            Bit 3: Button 2
- */
-static void perform_input_mapping(const u8 *data, int size)
+ * wii_memory_reply - take in a 0x21 memory read answer. The only read the
+ * driver issues is the calibration block, first at WII_CALIB_ADDR and, if
+ * that copy is unreadable or corrupt, at WII_CALIB_ADDR_COPY. Decoder only.
+ */
+static void wii_memory_reply(struct wii_remote *remote, const u8 *data, int size)
 {
-    char mapping_output[256];
-    int len = 0;
+    struct wii_calibration calib = { .source = WII_CALIB_EEPROM };
+    unsigned long flags;
+    u8 err, len;
+    u16 addr;
 
-    if (size < 3) {
-        printk(KERN_WARNING DRIVER_NAME ": Report too short for mapping\n");
+    if (size < WII_REPORT_MAX_LEN || remote->calib.source != WII_CALIB_PENDING)
+        return;
+    err = data[3] & 0x0f;
+    len = (data[3] >> 4) + 1;
+    addr = (data[4] << 8) | data[5];
+    if (addr != WII_CALIB_ADDR && addr != WII_CALIB_ADDR_COPY)
         return;
+
+    if (err || len < WII_CALIB_LEN ||
+        !wii_parse_calibration(&data[WII_MEM_REPLY_DATA], &calib)) {
+        if (addr == WII_CALIB_ADDR &&
+            !wii_read_memory(remote, WII_MEM_EEPROM, WII_CALIB_ADDR_COPY, WII_CALIB_LEN))
+            return;
+        printk(KERN_WARNING DRIVER_NAME ": %s: no valid calibration, using typical values\n",
+               dev_name(&remote->dev));
+        calib = remote->calib;
+        calib.source = WII_CALIB_NOMINAL;
     }
 
-    u8 report_id = data[0];
-    u8 btn_byte1 = data[1];
-    u8 btn_byte2 = data[2];
+    write_seqlock_irqsave(&remote->status_lock, flags);
+    remote->calib = calib;
+    write_sequnlock_irqrestore(&remote->status_lock, flags);
+}
 
-    len += snprintf(mapping_output + len, sizeof(mapping_output) - len,
-                    "Report: ID=%u, ", report_id);
-
-    if (btn_byte1 & 0x01)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Dpad_Right ");
-    if (btn_byte1 & 0x02)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Dpad_Left ");
-    if (btn_byte1 & 0x04)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Dpad_Down ");
-    if (btn_byte1 & 0x08)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Dpad_Up ");
-    if (btn_byte1 & 0x10)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Plus ");
-    if (btn_byte1 & 0x20)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Minus ");
-    if (btn_byte1 & 0x40)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "Home ");
-
-    if (btn_byte2 & 0x01)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "A ");
-    if (btn_byte2 & 0x02)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "B ");
-    if (btn_byte2 & 0x04)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "1 ");
-    if (btn_byte2 & 0x08)
-        len += snprintf(mapping_output + len, sizeof(mapping_output) - len, "2 ");
+/*
+ * wii_status_report - take in a 0x20 report: refresh the snapshot, note
+ * extension hot-plug and re-arm data reporting. Decoder only; the report is
+ * also decoded into the event stream as usual.
+ */
+static void wii_status_report(struct wii_remote *remote, const u8 *data, int size,
+                              u64 timestamp_ns)
+{
+    const struct wii_report_layout *layout = wii_report_layout(data[0]);
+    u8 old_flags = remote->status.flags;
+    unsigned long flags;
+    u8 status;
 
-    if (len == 0)
-        len = snprintf(mapping_output, sizeof(mapping_output), "No buttons pressed");
+    if (size < layout->len)
+        return;
+    status = data[layout->status];
 
-    if (len < sizeof(mapping_output) - 1) {
-        mapping_output[len++] = '\n';
-        mapping_output[len] = '\0';
-    }
+    write_seqlock_irqsave(&remote->status_lock, flags);
+    remote->status.battery = data[layout->status + WII_STATUS_BATTERY];
+    remote->status.flags = status & WII_STATUS_FLAGS;
+    remote->status.leds = status >> WII_STATUS_LEDS_SHIFT;
+    remote->status_ns = timestamp_ns;
+    write_sequnlock_irqrestore(&remote->status_lock, flags);
+
+    if ((old_flags ^ status) & WII_STATUS_F_EXT)
+        printk(KERN_INFO DRIVER_NAME ": %s: extension %s\n", dev_name(&remote->dev),
+               (status & WII_STATUS_F_EXT) ? "connected" : "disconnected");
 
-    circ_buffer_write(mapping_output, len);
+    wii_rearm_report_mode(remote);
 }
 
-/* Character device file operations */
-static int device_open(struct inode *inode, struct file *file)
+/*
+ * wii_set_capture - WIIMOTE_IOCTL_SET_CAPTURE: replace the capture ring with
+ * an empty one of size bytes, or stop capturing for 0. A capture counts as a
+ * user, so power_save does not cut it down to buttons while no file is open.
+ */
+static int wii_set_capture(struct wii_remote *remote, u32 size)
 {
+    struct circ_buffer *old, *new = NULL;
+
+    if (!capable(CAP_SYS_ADMIN))
+        return -EPERM;
+    if (size) {
+        if (size < WII_RING_MIN_SIZE || size > WII_CAPTURE_MAX_SIZE)
+            return -EINVAL;
+        new = circ_buffer_create(roundup_pow_of_two(size), sizeof(struct wii_raw_report),
+                                 &remote->capture_wait);
+        if (IS_ERR(new))
+            return PTR_ERR(new);
+        circ_buffer_set_overwrite(new, true);
+    }
+
+    mutex_lock(&remote->capture_lock);
+    old = rcu_dereference_protected(remote->capture, lockdep_is_held(&remote->capture_lock));
+    rcu_assign_pointer(remote->capture, new);
+    if (new && !old)
+        wii_user_get(remote);
+    else if (old && !new)
+        wii_user_put(remote);
+    /* Wait for wii_raw_event() to stop writing into the old ring */
+    synchronize_rcu();
+    mutex_unlock(&remote->capture_lock);
+
+    circ_buffer_destroy(old);
+    /* Readers of the old ring see the end of their capture */
+    wake_up_interruptible(&remote->capture_wait);
     return 0;
 }
 
-static int device_release(struct inode *inode, struct file *file)
+static bool wii_capture_ready(struct wii_remote *remote)
 {
-    return 0;
+    struct circ_buffer *ring;
+    bool ready;
+
+    rcu_read_lock();
+    ring = rcu_dereference(remote->capture);
+    ready = !ring || !circ_buffer_empty(ring) || READ_ONCE(remote->capture_closed);
+    rcu_read_unlock();
+    return ready;
 }
 
-static ssize_t device_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+/*
+ * wii_capture_read - read() of the debugfs capture file. Blocks for new
+ * records like device_read(); returns 0 while capture is off and once the
+ * remote has gone.
+ */
+static ssize_t wii_capture_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
 {
-    size_t bytes_copied = 0;
+    struct wii_remote *remote = file->private_data;
+    struct circ_buffer *ring;
+    ssize_t ret;
 
-    mutex_lock(&circ_mutex);
-    while (bytes_copied < count && tail != head) {
-        if (copy_to_user(buf + bytes_copied, &circ_buffer[tail], 1)) {
-            mutex_unlock(&circ_mutex);
-            return -EFAULT;
-        }
-        tail = (tail + 1) % CIRC_BUFFER_SIZE;
-        bytes_copied++;
+    for (;;) {
+        mutex_lock(&remote->capture_lock);
+        ring = rcu_dereference_protected(remote->capture,
+                                         lockdep_is_held(&remote->capture_lock));
+        if (!ring || remote->capture_closed)
+            ret = 0;
+        else if (circ_buffer_empty(ring))
+            ret = -EAGAIN;
+        else
+            ret = wii_ring_copy(ring, buf, count, NULL);
+        mutex_unlock(&remote->capture_lock);
+
+        if (ret != -EAGAIN || (file->f_flags & O_NONBLOCK))
+            return ret;
+        if (wait_event_interruptible(remote->capture_wait, wii_capture_ready(remote)))
+            return -ERESTARTSYS;
     }
-    mutex_unlock(&circ_mutex);
-    return bytes_copied;
+}
+
+static const struct file_operations wii_capture_fops = {
+    .owner  = THIS_MODULE,
+    .open   = simple_open,
+    .read   = wii_capture_read,
+};
+
+/* wii_capture - append a report to the capture ring, if capture is on */
+static void wii_capture(struct wii_remote *remote, const struct wii_raw_report *raw)
+{
+    struct circ_buffer *ring;
+
+    rcu_read_lock();
+    ring = rcu_dereference(remote->capture);
+    if (ring)
+        circ_buffer_write(ring, (const char *)raw, sizeof(*raw));
+    rcu_read_unlock();
 }
 
 static long device_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
+    struct wii_reader *reader = file->private_data;
+    struct wii_remote *remote = reader->remote;
+    struct wii_report_mode mode;
+    struct wii_ring_stats stats;
+    struct wii_read_batch batch;
+    struct wii_status_query query;
+    struct wii_calibration calib;
+    struct wii_ir_config ir;
+    struct wii_pattern pattern;
+    unsigned int seq;
+    u32 policy, size, val;
+    u8 request[2];
+    u64 now;
     int ret = 0;
     switch (cmd) {
     case WIIMOTE_IOCTL_REQUEST_STATUS:
-        if (wii_hid_dev) {
-            u8 status_request[2] = { 0x15, 0x00 };
-            printk(KERN_INFO "Sending battery status request (output report 0x15)\n");
-            ret = hid_hw_raw_request(wii_hid_dev,
-                                     status_request[0],
-                                     status_request,
-                                     sizeof(status_request),
-                                     HID_OUTPUT_REPORT,
-                                     HID_REQ_SET_REPORT);
-            printk(KERN_INFO "Battery status request returned: %d\n", ret);
-            if (ret < 0)
-                printk(KERN_ERR DRIVER_NAME ": failed to send status request, error %d\n", ret);
-        } else {
-            printk(KERN_ERR DRIVER_NAME ": HID device not available for status request\n");
-            ret = -ENODEV;
+        request[0] = 0x15;
+        request[1] = 0x00;
+        ret = wii_queue_output(remote, request, sizeof(request));
+        break;
+    case WIIMOTE_IOCTL_SET_REPORT_MODE:
+        if (copy_from_user(&mode, (void __user *)arg, sizeof(mode)))
+            return -EFAULT;
+        ret = wii_set_report_mode(remote, mode.mode, mode.continuous);
+        break;
+    case WIIMOTE_IOCTL_SET_LEDS:
+        if (get_user(val, (u32 __user *)arg))
+            return -EFAULT;
+        if (val & ~WII_LED_ALL)
+            return -EINVAL;
+        wii_pattern_stop(remote);
+        ret = wii_set_leds(remote, val);
+        break;
+    case WIIMOTE_IOCTL_SET_RUMBLE:
+        if (get_user(val, (u32 __user *)arg))
+            return -EFAULT;
+        wii_pattern_stop(remote);
+        /* Picked up by whatever report goes out next, 0x10 included */
+        WRITE_ONCE(remote->rumble, !!val);
+        request[0] = 0x10;
+        request[1] = !!val;
+        ret = wii_queue_output(remote, request, sizeof(request));
+        break;
+    case WIIMOTE_IOCTL_GET_RING_STATS:
+        mutex_lock(&reader->read_lock);
+        wii_get_ring_stats(reader, &stats);
+        mutex_unlock(&reader->read_lock);
+        if (copy_to_user((void __user *)arg, &stats, sizeof(stats)))
+            return -EFAULT;
+        break;
+    case WIIMOTE_IOCTL_SET_DROP_POLICY:
+        if (get_user(policy, (u32 __user *)arg))
+            return -EFAULT;
+        if (policy != WII_DROP_NEWEST && policy != WII_DROP_OLDEST)
+            return -EINVAL;
+        mutex_lock(&reader->read_lock);
+        ret = circ_buffer_set_overwrite(wii_ring(reader), policy == WII_DROP_OLDEST);
+        if (!ret)
+            reader->overwrite = policy == WII_DROP_OLDEST;
+        mutex_unlock(&reader->read_lock);
+        break;
+    case WIIMOTE_IOCTL_SET_RING_SIZE:
+        if (get_user(size, (u32 __user *)arg))
+            return -EFAULT;
+        if (size < CIRC_BUFFER_MIN_SIZE || size > CIRC_BUFFER_MAX_SIZE)
+            return -EINVAL;
+        mutex_lock(&reader->read_lock);
+        ret = wii_replace_ring(reader, roundup_pow_of_two(size), reader->raw);
+        mutex_unlock(&reader->read_lock);
+        break;
+    case WIIMOTE_IOCTL_SET_FORMAT:
+        if (get_user(val, (u32 __user *)arg))
+            return -EFAULT;
+        if (val != WII_FORMAT_EVENTS && val != WII_FORMAT_RAW)
+            return -EINVAL;
+        mutex_lock(&reader->read_lock);
+        if (reader->raw != (val == WII_FORMAT_RAW))
+            ret = wii_replace_ring(reader, wii_ring(reader)->size, val == WII_FORMAT_RAW);
+        mutex_unlock(&reader->read_lock);
+        break;
+    case WIIMOTE_IOCTL_GET_STATUS:
+        if (copy_from_user(&query, (void __user *)arg, sizeof(query)))
+            return -EFAULT;
+        wii_get_status(remote, &query.status);
+        query.refreshing = 0;
+
+        /* Ask again only if no refresh went out within the caller's bound either */
+        now = ktime_get_ns();
+        if (query.max_age_ms &&
+            query.status.age_ns > (u64)query.max_age_ms * NSEC_PER_MSEC &&
+            now - READ_ONCE(remote->status_request_ns) > (u64)query.max_age_ms * NSEC_PER_MSEC) {
+            request[0] = 0x15;
+            request[1] = 0x00;
+            if (!wii_queue_output(remote, request, sizeof(request))) {
+                WRITE_ONCE(remote->status_request_ns, now);
+                query.refreshing = 1;
+            }
         }
+
+        if (copy_to_user((void __user *)arg, &query, sizeof(query)))
+            return -EFAULT;
+        break;
+    case WIIMOTE_IOCTL_GET_CALIBRATION:
+        do {
+            seq = read_seqbegin(&remote->status_lock);
+            calib = remote->calib;
+        } while (read_seqretry(&remote->status_lock, seq));
+        if (copy_to_user((void __user *)arg, &calib, sizeof(calib)))
+            return -EFAULT;
+        break;
+    case WIIMOTE_IOCTL_READ_BATCH:
+        if (copy_from_user(&batch, (void __user *)arg, sizeof(batch)))
+            return -EFAULT;
+        ret = wii_read_batch(file, &batch);
+        if (!ret && put_user(batch.returned,
+                             &((struct wii_read_batch __user *)arg)->returned))
+            return -EFAULT;
+        break;
+    case WIIMOTE_IOCTL_SET_CAPTURE:
+        if (get_user(size, (u32 __user *)arg))
+            return -EFAULT;
+        ret = wii_set_capture(remote, size);
+        break;
+    case WIIMOTE_IOCTL_IR_INIT:
+        if (!IS_ENABLED(CONFIG_WII_REMOTE_IR))
+            return -EOPNOTSUPP;
+        if (copy_from_user(&ir, (void __user *)arg, sizeof(ir)))
+            return -EFAULT;
+        ret = wii_ir_start(remote, ir.mode, ir.sensitivity);
+        break;
+    case WIIMOTE_IOCTL_SET_PATTERN:
+        if (copy_from_user(&pattern, (void __user *)arg, sizeof(pattern)))
+            return -EFAULT;
+        ret = wii_pattern_start(remote, &pattern);
         break;
     default:
         ret = -ENOTTY;
@@ -196,90 +2086,705 @@ static struct file_operations fops = {
     .open           = device_open,
     .release        = device_release,
     .read           = device_read,
+    .poll           = device_poll,
+    .mmap           = device_mmap,
     .unlocked_ioctl = device_ioctl,
 };
 
+/*
+ * wii_all_attach - start queuing the remote's events for /dev/wii_remote_all.
+ * Called with wii_all_lock held. The source keeps the remote, and its open
+ * count, until wii_all_detach().
+ */
+static int wii_all_attach(struct wii_remote *remote)
+{
+    struct wii_all_source *src;
+    struct circ_buffer *ring;
+
+    lockdep_assert_held(&wii_all_lock);
+    src = kzalloc(sizeof(*src), GFP_KERNEL);
+    if (!src)
+        return -ENOMEM;
+    ring = circ_buffer_create(wii_ring_size(ring_size), sizeof(struct wii_event), &wii_all_wait);
+    if (IS_ERR(ring)) {
+        kfree(src);
+        return PTR_ERR(ring);
+    }
+
+    get_device(&remote->dev);
+    src->remote = remote;
+    src->ring = ring;
+    list_add_tail_rcu(&src->node, &wii_all_sources);
+    rcu_assign_pointer(remote->all_ring, ring);
+    wii_user_get(remote);
+    return 0;
+}
+
+/* Undo wii_all_attach(), discarding whatever is still queued */
+static void wii_all_detach(struct wii_all_source *src)
+{
+    struct wii_remote *remote = src->remote;
+
+    lockdep_assert_held(&wii_all_lock);
+    list_del_rcu(&src->node);
+    RCU_INIT_POINTER(remote->all_ring, NULL);
+    wii_user_put(remote);
+    /* Wait for the producer and for lockless walkers of the list */
+    synchronize_rcu();
+
+    circ_buffer_destroy(src->ring);
+    kfree(src);
+    put_device(&remote->dev);
+}
+
+/* Whether any source has an event queued; safe in a wait condition */
+static bool wii_all_pending(void)
+{
+    struct wii_all_source *src;
+    bool pending = false;
+
+    rcu_read_lock();
+    list_for_each_entry_rcu(src, &wii_all_sources, node) {
+        if (!circ_buffer_empty(src->ring)) {
+            pending = true;
+            break;
+        }
+    }
+    rcu_read_unlock();
+    return pending;
+}
+
+/*
+ * wii_all_merge - copy up to count bytes of whole events to buf, oldest
+ * first across all sources. Every source is in arrival order, so comparing
+ * the records at their fronts is enough. Sources of disconnected remotes
+ * are dropped once drained. Called with wii_all_lock held.
+ */
+static ssize_t wii_all_merge(char __user *buf, size_t count)
+{
+    const size_t record_size = sizeof(struct wii_event);
+    struct wii_all_source *src, *next, *oldest;
+    size_t bytes_copied = 0;
+    u64 ts, oldest_ns = 0;
+    ssize_t ret = 0;
+
+    lockdep_assert_held(&wii_all_lock);
+    if (count < record_size)
+        return -EINVAL;
+
+    while (bytes_copied + record_size <= count) {
+        oldest = NULL;
+        list_for_each_entry(src, &wii_all_sources, node) {
+            if (circ_buffer_empty(src->ring))
+                continue;
+            ts = wii_record_timestamp(src->ring, circ_buffer_read_begin(src->ring));
+            if (!oldest || ts < oldest_ns) {
+                oldest = src;
+                oldest_ns = ts;
+            }
+        }
+        if (!oldest)
+            break;
+
+        /* Exactly one record; the rings never overwrite, so this cannot retry */
+        ret = wii_ring_copy(oldest->ring, buf + bytes_copied, record_size, NULL);
+        if (ret < 0)
+            break;
+        bytes_copied += ret;
+        wii_stat_add(oldest->remote, bytes_read, ret);
+    }
+
+    /* connected is cleared only after the remote's last event was queued */
+    list_for_each_entry_safe(src, next, &wii_all_sources, node)
+        if (!READ_ONCE(src->remote->connected) && circ_buffer_empty(src->ring))
+            wii_all_detach(src);
+
+    if (bytes_copied)
+        return bytes_copied;
+    return ret;
+}
+
+/* Only one reader: the rings have a single consumer each */
+static int all_device_open(struct inode *inode, struct file *file)
+{
+    struct wii_all_source *src, *next;
+    int i, ret = 0;
+
+    mutex_lock(&wii_all_lock);
+    if (wii_all_opened) {
+        mutex_unlock(&wii_all_lock);
+        return -EBUSY;
+    }
+    for (i = 0; i < WII_MAX_REMOTES && !ret; i++)
+        if (wii_remotes[i])
+            ret = wii_all_attach(wii_remotes[i]);
+    if (ret)
+        list_for_each_entry_safe(src, next, &wii_all_sources, node)
+            wii_all_detach(src);
+    else
+        wii_all_opened = true;
+    mutex_unlock(&wii_all_lock);
+    return ret;
+}
+
+static int all_device_release(struct inode *inode, struct file *file)
+{
+    struct wii_all_source *src, *next;
+
+    mutex_lock(&wii_all_lock);
+    list_for_each_entry_safe(src, next, &wii_all_sources, node)
+        wii_all_detach(src);
+    wii_all_opened = false;
+    mutex_unlock(&wii_all_lock);
+    return 0;
+}
+
+/*
+ * all_device_read - like device_read(), over the merged stream. Remotes come
+ * and go underneath it, so there is no end of stream: with nothing queued it
+ * waits, or returns -EAGAIN under O_NONBLOCK.
+ */
+static ssize_t all_device_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+    ssize_t ret = 0;
+
+    if (!count)
+        return 0;
+
+    while (!ret) {
+        if (!wii_all_pending()) {
+            if (file->f_flags & O_NONBLOCK)
+                return -EAGAIN;
+            if (wait_event_interruptible(wii_all_wait, wii_all_pending()))
+                return -ERESTARTSYS;
+        }
+
+        mutex_lock(&wii_all_lock);
+        ret = wii_all_merge(buf, count);
+        mutex_unlock(&wii_all_lock);
+    }
+    return ret;
+}
+
+static __poll_t all_device_poll(struct file *file, poll_table *wait)
+{
+    poll_wait(file, &wii_all_wait, wait);
+    return wii_all_pending() ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static const struct file_operations all_fops = {
+    .owner          = THIS_MODULE,
+    .open           = all_device_open,
+    .release        = all_device_release,
+    .read           = all_device_read,
+    .poll           = all_device_poll,
+};
+
+/* wii_probe(): make the remote visible to /dev/wii_remote_all */
+static void wii_all_add(struct wii_remote *remote)
+{
+    mutex_lock(&wii_all_lock);
+    wii_remotes[remote->index] = remote;
+    if (wii_all_opened && wii_all_attach(remote))
+        printk(KERN_WARNING DRIVER_NAME ": %s: not added to %s_all\n",
+               dev_name(&remote->dev), DEVICE_NAME);
+    mutex_unlock(&wii_all_lock);
+}
+
+/*
+ * wii_remove(), once connected is cleared: take the remote out of the table.
+ * Its source stays until the reader has drained it, or goes now if empty.
+ */
+static void wii_all_remove(struct wii_remote *remote)
+{
+    struct wii_all_source *src, *next;
+
+    mutex_lock(&wii_all_lock);
+    wii_remotes[remote->index] = NULL;
+    list_for_each_entry_safe(src, next, &wii_all_sources, node)
+        if (src->remote == remote && circ_buffer_empty(src->ring))
+            wii_all_detach(src);
+    mutex_unlock(&wii_all_lock);
+}
+
+/* Add /dev/wii_remote_all at load time; the driver works without it */
+static void wii_all_create(void)
+{
+    dev_t devt = MKDEV(major, WII_ALL_MINOR);
+    struct device *dev;
+
+    cdev_init(&wii_all_cdev, &all_fops);
+    wii_all_cdev.owner = THIS_MODULE;
+    if (cdev_add(&wii_all_cdev, devt, 1))
+        goto fail;
+    dev = device_create(wii_class, NULL, devt, NULL, DEVICE_NAME "_all");
+    if (IS_ERR(dev)) {
+        cdev_del(&wii_all_cdev);
+        goto fail;
+    }
+    wii_all_dev = dev;
+    return;
+
+fail:
+    printk(KERN_WARNING DRIVER_NAME ": failed to create /dev/%s_all\n", DEVICE_NAME);
+}
+
+/* Its file pins the module, so nothing can have it open here */
+static void wii_all_destroy(void)
+{
+    if (!wii_all_dev)
+        return;
+    device_destroy(wii_class, wii_all_dev->devt);
+    cdev_del(&wii_all_cdev);
+    wii_all_dev = NULL;
+}
+
 
 static int wii_proc_show(struct seq_file *m, void *v)
 {
+    struct wii_remote *remote = m->private;
+    struct wii_ring_stats stats;
+    struct wii_status status;
+    struct wii_calibration calib;
+    struct circ_buffer *capture, *ring;
+    struct wii_reader *reader;
+    struct wii_pcpu_stats *sum;
+    unsigned int seq;
+    u64 uptime_s;
+    int i, n = 0;
+
+    wii_get_status(remote, &status);
+
     seq_printf(m, "Wii Remote Driver State:\n");
-    seq_printf(m, "  Connected: %s\n", wii_connected ? "Yes" : "No");
-    seq_printf(m, "  Last Battery: %d\n", wii_last_battery);
+    seq_printf(m, "  Device: %s\n", dev_name(&remote->dev));
+    seq_printf(m, "  Connected: %s\n", READ_ONCE(remote->connected) ? "Yes" : "No");
+    if (status.age_ns == U64_MAX)
+        seq_printf(m, "  Last Battery: -1\n");
+    else
+        seq_printf(m, "  Last Battery: %u (%llu ms ago)\n", status.battery,
+                   status.age_ns / NSEC_PER_MSEC);
+    seq_printf(m, "  Report Mode: 0x%02x%s\n", status.report_mode,
+               status.continuous ? " (continuous)" : "");
+    seq_printf(m, "  Power: %s, %lu changes\n",
+               READ_ONCE(remote->idle) == WII_IDLE_UNUSED ? "buttons only (unused)" :
+               READ_ONCE(remote->idle) == WII_IDLE_STILL ? "changes only (still)" : "active",
+               READ_ONCE(remote->idle_changes));
+    seq_printf(m, "  LEDs: 0x%x%s%s\n", status.leds,
+               READ_ONCE(remote->rumble) ? ", rumbling" : "",
+               READ_ONCE(remote->pattern) ? ", playing a pattern" : "");
+    seq_printf(m, "  IR Camera: %s\n",
+               status.ir_state == WII_IR_STATE_BUSY ? "setting up" :
+               status.ir_state == WII_IR_STATE_READY ? "ready" :
+               status.ir_state == WII_IR_STATE_FAILED ? "set-up failed" : "off");
+    seq_printf(m, "  Output: %lu sent, %lu coalesced, %lu failed\n", READ_ONCE(remote->out_sent),
+               READ_ONCE(remote->out_coalesced), READ_ONCE(remote->out_failed));
+    do {
+        seq = read_seqbegin(&remote->status_lock);
+        calib = remote->calib;
+    } while (read_seqretry(&remote->status_lock, seq));
+    seq_printf(m, "  Calibration (%s): zero %u,%u,%u, 1g %u,%u,%u\n",
+               calib.source == WII_CALIB_EEPROM ? "remote" :
+               calib.source == WII_CALIB_PENDING ? "reading" : "typical",
+               calib.zero[0], calib.zero[1], calib.zero[2],
+               calib.one_g[0], calib.one_g[1], calib.one_g[2]);
+
+    mutex_lock(&remote->capture_lock);
+    capture = rcu_dereference_protected(remote->capture, lockdep_is_held(&remote->capture_lock));
+    if (capture)
+        seq_printf(m, "  Capture: %u bytes, %lu reports, %lu overwritten, %u queued\n",
+                   capture->size, READ_ONCE(capture->stats.enqueued),
+                   READ_ONCE(capture->stats.overwritten), circ_buffer_queued(capture));
+    else
+        seq_printf(m, "  Capture: off\n");
+    mutex_unlock(&remote->capture_lock);
+
+    mutex_lock(&remote->readers_lock);
+    list_for_each_entry(reader, &remote->readers, node) {
+        mutex_lock(&reader->read_lock);
+        wii_get_ring_stats(reader, &stats);
+        mutex_unlock(&reader->read_lock);
+
+        seq_printf(m, "  Reader %d:%s\n", n++, READ_ONCE(reader->raw) ? " raw reports" : "");
+        seq_printf(m, "    Buffer: %u bytes, %s when full\n", stats.size,
+                   READ_ONCE(reader->overwrite) ? "overwrite oldest" : "drop newest");
+        seq_printf(m, "    Enqueued: %llu\n", stats.enqueued);
+        seq_printf(m, "    Dropped: %llu\n", stats.dropped);
+        seq_printf(m, "    Overwritten: %llu\n", stats.overwritten);
+        seq_printf(m, "    High Water: %u\n", stats.high_water);
+    }
+    mutex_unlock(&remote->readers_lock);
+    seq_printf(m, "  Readers: %d\n", n);
+
+    mutex_lock(&wii_all_lock);
+    ring = rcu_dereference_protected(remote->all_ring, lockdep_is_held(&wii_all_lock));
+    if (ring)
+        seq_printf(m, "  Aggregate: %u bytes queued, %lu enqueued, %lu dropped\n",
+                   circ_buffer_queued(ring), READ_ONCE(ring->stats.enqueued),
+                   READ_ONCE(ring->stats.dropped));
+    mutex_unlock(&wii_all_lock);
+
+    if (!IS_ENABLED(CONFIG_WII_REMOTE_STATS))
+        return 0;
+    sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+    if (!sum)
+        return -ENOMEM;
+    wii_sum_stats(remote, sum);
+
+    uptime_s = max_t(u64, div_u64(ktime_get_ns() - remote->connected_ns, NSEC_PER_SEC), 1);
+    seq_printf(m, "  Reports (%llu s):\n", uptime_s);
+    for (i = 0; i < ARRAY_SIZE(sum->reports); i++)
+        if (sum->reports[i])
+            seq_printf(m, "    0x%02x: %lu (%llu/s)\n", WII_REPORT_FIRST + i, sum->reports[i],
+                       div64_u64(sum->reports[i], uptime_s));
+    if (sum->reports_other)
+        seq_printf(m, "    other: %lu\n", sum->reports_other);
+    seq_printf(m, "  Bytes: %lu received, %lu enqueued, %lu read\n", sum->bytes_received,
+               sum->bytes_enqueued, sum->bytes_read);
+    if (remote->raw_ring)
+        seq_printf(m, "  Decode Queue: %lu dropped, %u bytes high water\n",
+                   READ_ONCE(remote->raw_ring->stats.dropped),
+                   READ_ONCE(remote->raw_ring->stats.high_water));
+
+    /* Bucket i holds samples below 2^i us */
+    seq_printf(m, "  Handler Time (us):");
+    for (i = 0; i < WII_HIST_BUCKETS; i++)
+        seq_printf(m, " <%lu:%lu", 1UL << i, sum->handler_hist[i]);
+    if (remote->raw_ring) {
+        seq_printf(m, "\n  Decode Time (us):");
+        for (i = 0; i < WII_HIST_BUCKETS; i++)
+            seq_printf(m, " <%lu:%lu", 1UL << i, sum->decode_hist[i]);
+    }
+    seq_printf(m, "\n  Read Latency (us):");
+    for (i = 0; i < WII_HIST_BUCKETS; i++)
+        seq_printf(m, " <%lu:%lu", 1UL << i, sum->latency_hist[i]);
+    seq_printf(m, "\n");
+
+    kfree(sum);
     return 0;
 }
 
-static int wii_proc_open(struct inode *inode, struct file *file)
+/*
+ * wii_process_report - everything done with one input report after it was
+ * received. Status reports (0x20) also refresh the cached status, memory
+ * reads (0x21) may carry the calibration and acknowledgements (0x22) drive the
+ * IR camera set-up; every report then goes through
+ * input mapping. Runs in decode_work, or in wii_raw_event() without
+ * deferred_decode, never in both.
+ */
+static void wii_process_report(struct wii_remote *remote, const u8 *data, int size,
+                               u64 timestamp_ns)
 {
-    return single_open(file, wii_proc_show, NULL);
+    if (size > 0 && data[0] == 0x20)
+        wii_status_report(remote, data, size, timestamp_ns);
+    else if (size > 0 && data[0] == 0x21)
+        wii_memory_reply(remote, data, size);
+    else if (IS_ENABLED(CONFIG_WII_REMOTE_IR) && size > 0 && data[0] == 0x22)
+        wii_output_ack(remote, data, size);
+    perform_input_mapping(remote, data, size, timestamp_ns);
 }
 
+/* wii_decode_work - decode the raw reports wii_raw_event() queued, oldest first */
+static void wii_decode_work(struct work_struct *work)
+{
+    struct wii_remote *remote = container_of(work, struct wii_remote, decode_work);
+    struct circ_buffer *ring = remote->raw_ring;
+    const struct wii_raw_report *raw;
+    unsigned int tail;
+    u64 start_ns = 0;
 
-static const struct proc_ops wii_proc_ops = {
-    .proc_open    = wii_proc_open,
-    .proc_read    = seq_read,
-    .proc_lseek   = seq_lseek,
-    .proc_release = single_release,
-};
+    while (!circ_buffer_empty(ring)) {
+        tail = circ_buffer_read_begin(ring);
+        /* Records divide the power-of-two ring, so one never wraps */
+        if (circ_buffer_peek(ring, tail, (const char **)&raw) < sizeof(*raw))
+            break;
 
-/* Character device variables */
-static int major;
-static struct class *wii_class;
-static struct cdev wii_cdev;
+        if (IS_ENABLED(CONFIG_WII_REMOTE_STATS))
+            start_ns = ktime_get_ns();
+        wii_process_report(remote, raw->data, raw->len, raw->timestamp_ns);
+        wii_hist_add(remote->pstats->decode_hist, start_ns);
+
+        /* Never overwritten, so the commit cannot fail */
+        circ_buffer_read_commit(ring, tail, tail + sizeof(*raw));
+    }
+}
 
 /*
  * wii_raw_event - HID raw event callback.
  *
  * When a new HID report is received from the Wii remote, this callback is invoked.
- * otherwise, we perform input mapping.
+ * It copies the report to the capture ring and to readers in WII_FORMAT_RAW
+ * and, with deferred_decode, queues it for decode_work; otherwise it decodes it
+ * right here. Reports are traced through the wii_remote:wii_raw_report
+ * tracepoint rather than logged; the capture ring is the cheaper alternative.
+ *
+ * The timestamp is taken first so that every event records when its report
+ * arrived, not when it happened to be decoded or read.
  */
 static int wii_raw_event(struct hid_device *hdev, struct hid_report *report, u8 *data, int size)
 {
-    int i;
-    printk(KERN_INFO "wii_raw_event: received report: ");
-    for (i = 0; i < size; i++)
-        printk(KERN_CONT "%02x ", data[i]);
-    printk(KERN_CONT "\n");
-
-    if (size > 0 && data[0] == 0x20) {
-        printk(KERN_INFO "Battery status report detected.\n");
-        if (size >= 2) {
-            char battery_output[64];
-            int len = snprintf(battery_output, sizeof(battery_output), "Battery: %d\n", data[1]);
-            /* Cache the battery level */
-            wii_last_battery = data[1];
-            circ_buffer_write(battery_output, len);
-        }
+    u64 timestamp_ns = ktime_get_ns();
+    struct wii_remote *remote = hid_get_drvdata(hdev);
+    struct wii_raw_report raw;
+
+    trace_wii_raw_report(data, size);
+
+    wii_stat_add(remote, bytes_received, size);
+    if (size > 0 && size <= WII_RAW_MAX_LEN &&
+        data[0] >= WII_REPORT_FIRST && data[0] <= WII_REPORT_LAST) {
+        wii_stat_inc(remote, reports[data[0] - WII_REPORT_FIRST]);
+    } else {
+        /* Not something the remote sends; nothing below would use it */
+        wii_stat_inc(remote, reports_other);
+        return 0;
+    }
+
+    memset(&raw, 0, sizeof(raw));
+    raw.timestamp_ns = timestamp_ns;
+    raw.len = size;
+    memcpy(raw.data, data, size);
+    wii_capture(remote, &raw);
+    wii_fan_out(remote, sizeof(raw), (const char *)&raw, sizeof(raw));
+
+    if (remote->decode_wq) {
+        /* A full queue drops the report; counted in the raw ring's stats */
+        if (circ_buffer_write(remote->raw_ring, (const char *)&raw, sizeof(raw)))
+            queue_work(remote->decode_wq, &remote->decode_work);
     } else {
-        perform_input_mapping(data, size);
+        wii_process_report(remote, data, size, timestamp_ns);
     }
+
+    wii_hist_add(remote->pstats->handler_hist, timestamp_ns);
     return 0;
 }
 
+/*
+ * wii_quiesce - stop everything that still runs on the remote's behalf once
+ * the HID device is stopped: pending decoding and output reports.
+ */
+static void wii_quiesce(struct wii_remote *remote)
+{
+    /* No output report may reach a stopped device */
+    mutex_lock(&remote->lock);
+    remote->hdev = NULL;
+    mutex_unlock(&remote->lock);
+
+    /* Decoding may queue output (mode re-arm), so it goes first */
+    if (remote->decode_wq)
+        flush_workqueue(remote->decode_wq);
+
+    spin_lock_irq(&remote->out_lock);
+    remote->out_closed = true;
+    spin_unlock_irq(&remote->out_lock);
+    /* A tick may have queued output just before out_closed was set */
+    wii_pattern_stop(remote);
+    cancel_work_sync(&remote->out_work);
+    cancel_delayed_work_sync(&remote->ir_timeout);
+    cancel_work_sync(&remote->idle_work);
+}
+
+/* Final put_device() on a remote: nothing can reach it any more */
+static void wii_remote_release(struct device *dev)
+{
+    struct wii_remote *remote = container_of(dev, struct wii_remote, dev);
+
+    /* A file released after wii_remove() may still have queued it */
+    cancel_work_sync(&remote->idle_work);
+    cancel_work_sync(&remote->out_work);
+    if (remote->index >= 0)
+        ida_free(&wii_minors, remote->index);
+    if (remote->decode_wq)
+        destroy_workqueue(remote->decode_wq);
+    circ_buffer_destroy(remote->raw_ring);
+    circ_buffer_destroy(rcu_dereference_protected(remote->capture, 1));
+    free_percpu(remote->pstats);
+    kfree(remote);
+}
+
 /* HID probe: called when a matching device is connected */
 static int wii_probe(struct hid_device *hdev, const struct hid_device_id *id)
 {
-    int ret;
+    struct wii_remote *remote;
+    char proc_name[16];
+    int i, ret;
+
+    remote = kzalloc(sizeof(*remote), GFP_KERNEL);
+    if (!remote)
+        return -ENOMEM;
+
+    /* From here on every failure is unwound by put_device() */
+    remote->index = -1;
+    seqlock_init(&remote->status_lock);
+    remote->status.report_mode = 0x30;  /* the remote's power-on mode */
+    remote->req_mode = 0x30;
+    remote->leds = WII_LEDS_UNKNOWN;
+    /* Nothing is open yet; 0x30 is what the remote sends anyway */
+    remote->idle = remote->idle_target = power_save ? WII_IDLE_UNUSED : WII_IDLE_ACTIVE;
+    for (i = 0; i < 3; i++) {
+        remote->calib.zero[i] = WII_ACCEL_ZERO_NOMINAL;
+        remote->calib.one_g[i] = WII_ACCEL_ONE_G_NOMINAL;
+    }
+    remote->calib.source = WII_CALIB_PENDING;
+    mutex_init(&remote->lock);
+    INIT_LIST_HEAD(&remote->readers);
+    mutex_init(&remote->readers_lock);
+    spin_lock_init(&remote->out_lock);
+    remote->out_closed = true;          /* until hid_hw_start() succeeds */
+    INIT_WORK(&remote->out_work, wii_output_work);
+    INIT_WORK(&remote->decode_work, wii_decode_work);
+    INIT_WORK(&remote->idle_work, wii_idle_work);
+    INIT_DELAYED_WORK(&remote->ir_timeout, wii_ir_timeout);
+    hrtimer_setup(&remote->pattern_timer, wii_pattern_tick, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_SOFT);
+    mutex_init(&remote->pattern_lock);
+    mutex_init(&remote->capture_lock);
+    init_waitqueue_head(&remote->capture_wait);
+    device_initialize(&remote->dev);
+    remote->dev.class = wii_class;
+    remote->dev.parent = &hdev->dev;
+    remote->dev.release = wii_remote_release;
+
+    if (IS_ENABLED(CONFIG_WII_REMOTE_STATS)) {
+        remote->pstats = alloc_percpu(struct wii_pcpu_stats);
+        if (!remote->pstats) {
+            ret = -ENOMEM;
+            goto err_put;
+        }
+    }
+    remote->connected_ns = ktime_get_ns();
+
+    ret = ida_alloc_max(&wii_minors, WII_MAX_REMOTES - 1, GFP_KERNEL);
+    if (ret < 0) {
+        printk(KERN_ERR DRIVER_NAME ": no free minor, at most %d remotes\n", WII_MAX_REMOTES);
+        goto err_put;
+    }
+    remote->index = ret;
+    remote->dev.devt = MKDEV(major, remote->index);
+    ret = dev_set_name(&remote->dev, DEVICE_NAME "%d", remote->index);
+    if (ret)
+        goto err_put;
+
+    remote->record_size = IS_ENABLED(CONFIG_WII_REMOTE_TEXT) && text_events ?
+                          0 : sizeof(struct wii_event);
+
+    if (deferred_decode) {
+        remote->raw_ring = circ_buffer_create(roundup_pow_of_two(WII_RAW_RING_SIZE),
+                                              sizeof(struct wii_raw_report), NULL);
+        if (IS_ERR(remote->raw_ring)) {
+            ret = PTR_ERR(remote->raw_ring);
+            remote->raw_ring = NULL;
+            goto err_put;
+        }
+        remote->decode_wq = alloc_ordered_workqueue("%s", WQ_HIGHPRI, dev_name(&remote->dev));
+        if (!remote->decode_wq) {
+            ret = -ENOMEM;
+            goto err_put;
+        }
+    }
+
+    remote->hdev = hdev;
+    remote->connected = true;
+    hid_set_drvdata(hdev, remote);
 
     ret = hid_parse(hdev);
     if (ret)
-        return ret;
+        goto err_put;
+
+    /* Registered before the first raw event can arrive */
+    if (input_device) {
+        ret = wii_input_register(remote, hdev);
+        if (ret) {
+            printk(KERN_ERR DRIVER_NAME ": failed to register input device, error %d\n", ret);
+            goto err_put;
+        }
+    }
 
     ret = hid_hw_start(hdev, HID_CONNECT_DEFAULT);
     if (ret)
-        return ret;
+        goto err_input;
+
+    /* Output may flow now; idle_work applies any level an input open asked for */
+    spin_lock_irq(&remote->out_lock);
+    remote->out_closed = false;
+    spin_unlock_irq(&remote->out_lock);
+    schedule_work(&remote->idle_work);
+
+    cdev_init(&remote->cdev, &fops);
+    remote->cdev.owner = THIS_MODULE;
+    ret = cdev_device_add(&remote->cdev, &remote->dev);
+    if (ret) {
+        printk(KERN_ERR DRIVER_NAME ": failed to add %s\n", dev_name(&remote->dev));
+        goto err_stop;
+    }
+
+    snprintf(proc_name, sizeof(proc_name), "remote%d", remote->index);
+    remote->proc_entry = proc_create_single_data(proc_name, 0444, wii_proc_dir,
+                                                 wii_proc_show, remote);
+    if (!remote->proc_entry)
+        printk(KERN_WARNING DRIVER_NAME ": failed to create /proc/wii_remote/%s\n", proc_name);
+    remote->capture_file = debugfs_create_file(dev_name(&remote->dev), 0400, wii_debugfs_dir,
+                                               remote, &wii_capture_fops);
 
-    wii_hid_dev = hdev;
-    wii_connected = 1;
-    printk(KERN_INFO DRIVER_NAME ": Wii remote connected\n");
+    /* Answered through wii_raw_event(); probing does not wait for it */
+    if (wii_read_memory(remote, WII_MEM_EEPROM, WII_CALIB_ADDR, WII_CALIB_LEN))
+        remote->calib.source = WII_CALIB_NOMINAL;
+    if (IS_ENABLED(CONFIG_WII_REMOTE_IR) && ir_mode && wii_ir_start(remote, ir_mode, ir_sensitivity))
+        printk(KERN_WARNING DRIVER_NAME ": %s: invalid ir_mode %u or ir_sensitivity %u\n",
+               dev_name(&remote->dev), ir_mode, ir_sensitivity);
+    if (remote->record_size)
+        wii_all_add(remote);
+
+    printk(KERN_INFO DRIVER_NAME ": Wii remote connected as %s\n", dev_name(&remote->dev));
     return 0;
+
+err_stop:
+    hid_hw_stop(hdev);
+err_input:
+    /* An input handler's open may have queued idle_work and, through it, out_work */
+    wii_quiesce(remote);
+    if (remote->input)
+        input_unregister_device(remote->input);
+err_put:
+    put_device(&remote->dev);
+    return ret;
 }
 
 /* HID remove: called when the device is disconnected */
 static void wii_remove(struct hid_device *hdev)
 {
-    wii_hid_dev = NULL;
-    wii_connected = 0;
-    printk(KERN_INFO DRIVER_NAME ": Wii remote disconnected\n");
+    struct wii_remote *remote = hid_get_drvdata(hdev);
+    struct wii_reader *reader;
+
+    proc_remove(remote->proc_entry);
+
+    /* debugfs removal waits for readers, so get the blocked ones out first */
+    mutex_lock(&remote->capture_lock);
+    WRITE_ONCE(remote->capture_closed, true);
+    mutex_unlock(&remote->capture_lock);
+    wake_up_interruptible(&remote->capture_wait);
+    debugfs_remove(remote->capture_file);
+
+    /* No new output reports once hdev is cleared */
+    mutex_lock(&remote->lock);
+    remote->hdev = NULL;
+    mutex_unlock(&remote->lock);
+
+    /* No more raw events after this returns; then let decoding finish */
+    hid_hw_stop(hdev);
+    wii_quiesce(remote);
+    if (remote->input)
+        input_unregister_device(remote->input);
+
+    /* Let blocked readers drain what is left and then see the disconnect */
+    WRITE_ONCE(remote->connected, false);
+    mutex_lock(&remote->readers_lock);
+    list_for_each_entry(reader, &remote->readers, node)
+        wake_up_interruptible_poll(&reader->read_wait, EPOLLHUP | EPOLLERR);
+    mutex_unlock(&remote->readers_lock);
+    if (remote->record_size)
+        wii_all_remove(remote);
+
+    printk(KERN_INFO DRIVER_NAME ": Wii remote %s disconnected\n", dev_name(&remote->dev));
+    cdev_device_del(&remote->cdev, &remote->dev);
+    put_device(&remote->dev);
 }
 
 /* HID device ID table for the Wii remote.
@@ -305,47 +2810,45 @@ static int __init wii_init(void)
     int ret;
     dev_t dev;
 
-
-    wii_proc_entry = proc_create("wii_remote", 0, NULL, &wii_proc_ops);
-    if (!wii_proc_entry) {
+    wii_proc_dir = proc_mkdir("wii_remote", NULL);
+    if (!wii_proc_dir) {
         printk(KERN_ERR DRIVER_NAME ": failed to create /proc/wii_remote\n");
         return -ENOMEM;
     }
 
-    /* Allocate a character device region */
-    ret = alloc_chrdev_region(&dev, 0, 1, DEVICE_NAME);
+    /* Allocate a character device region, one minor per remote and one for the aggregate */
+    ret = alloc_chrdev_region(&dev, 0, WII_MAX_REMOTES + 1, DEVICE_NAME);
     if (ret < 0) {
+        proc_remove(wii_proc_dir);
         printk(KERN_ERR DRIVER_NAME ": failed to allocate char device region\n");
         return ret;
     }
     major = MAJOR(dev);
 
-    /* Initialize and add the character device */
-    cdev_init(&wii_cdev, &fops);
-    ret = cdev_add(&wii_cdev, dev, 1);
-    if (ret < 0) {
-        unregister_chrdev_region(dev, 1);
-        printk(KERN_ERR DRIVER_NAME ": failed to add cdev\n");
-        return ret;
-    }
-
-    /* Create a device class and file in /dev */
+    /* Create a device class; wii_probe() adds a /dev node per remote */
     wii_class = class_create(DEVICE_NAME);
     if (IS_ERR(wii_class)) {
-        cdev_del(&wii_cdev);
-        unregister_chrdev_region(dev, 1);
+        unregister_chrdev_region(dev, WII_MAX_REMOTES + 1);
+        proc_remove(wii_proc_dir);
         printk(KERN_ERR DRIVER_NAME ": failed to create class\n");
         return PTR_ERR(wii_class);
     }
-    device_create(wii_class, NULL, dev, NULL, DEVICE_NAME);
+
+    /* Capture files; the driver works without debugfs */
+    wii_debugfs_dir = debugfs_create_dir("wii_remote", NULL);
+
+    /* Merged text lines could not be told apart, so binary events only */
+    if (aggregate_device && !(IS_ENABLED(CONFIG_WII_REMOTE_TEXT) && text_events))
+        wii_all_create();
 
     /* Register the HID driver */
     ret = hid_register_driver(&wii_driver);
     if (ret) {
-        device_destroy(wii_class, dev);
+        wii_all_destroy();
+        debugfs_remove(wii_debugfs_dir);
         class_destroy(wii_class);
-        cdev_del(&wii_cdev);
-        unregister_chrdev_region(dev, 1);
+        unregister_chrdev_region(dev, WII_MAX_REMOTES + 1);
+        proc_remove(wii_proc_dir);
         printk(KERN_ERR DRIVER_NAME ": failed to register HID driver\n");
         return ret;
     }
@@ -358,16 +2861,14 @@ static void __exit wii_exit(void)
 {
     dev_t dev = MKDEV(major, 0);
 
-    if (wii_proc_entry) {
-        remove_proc_entry("wii_remote", NULL);
-        wii_proc_entry = NULL;
-    }
-
+    /* Removes every bound remote first */
     hid_unregister_driver(&wii_driver);
-    device_destroy(wii_class, dev);
+    wii_all_destroy();
+    debugfs_remove(wii_debugfs_dir);
     class_destroy(wii_class);
-    cdev_del(&wii_cdev);
-    unregister_chrdev_region(dev, 1);
+    unregister_chrdev_region(dev, WII_MAX_REMOTES + 1);
+    proc_remove(wii_proc_dir);
+    ida_destroy(&wii_minors);
 
     printk(KERN_INFO DRIVER_NAME ": driver unloaded\n");
 }
@@ -0,0 +1,47 @@
+/*
+ * wii-remote-trace.h - tracepoints for the Wii Remote driver.
+ *
+ * These replace the per-report printk dump. They cost a patched-out branch
+ * while disabled; turn them on when needed with
+ *
+ *   echo 1 > /sys/kernel/tracing/events/wii_remote/enable
+ *   cat /sys/kernel/tracing/trace_pipe
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM wii_remote
+
+#if !defined(WII_REMOTE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define WII_REMOTE_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(wii_raw_report,
+
+    TP_PROTO(const u8 *data, int size),
+
+    TP_ARGS(data, size),
+
+    TP_STRUCT__entry(
+        __field(u8, report_id)
+        __field(int, size)
+        __dynamic_array(u8, data, size)
+    ),
+
+    TP_fast_assign(
+        __entry->report_id = size > 0 ? data[0] : 0;
+        __entry->size = size;
+        memcpy(__get_dynamic_array(data), data, size);
+    ),
+
+    TP_printk("id=0x%02x len=%d data=%s", __entry->report_id, __entry->size,
+              __print_hex(__get_dynamic_array(data), __get_dynamic_array_len(data)))
+);
+
+#endif /* WII_REMOTE_TRACE_H */
+
+/* This part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE wii-remote-trace
+#include <trace/define_trace.h>
@@ -0,0 +1,399 @@
+/*
+ * wii-remote.h - interface between the Wii Remote driver and user space.
+ *
+ * Include this from applications that read /dev/wii_remote or issue its
+ * ioctls. It only depends on the exported kernel types.
+ */
+
+#ifndef WII_REMOTE_H
+#define WII_REMOTE_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Output ioctls (status request, report mode, LEDs and rumble) queue their
+ * output report and return at once; a worker sends it to the remote. A newer
+ * request of the same kind replaces one that is still waiting. They fail with
+ * -EAGAIN when the output queue is full and -ENODEV once the remote is gone.
+ */
+
+/* IOCTL command to request a battery/status update */
+#define WIIMOTE_IOCTL_REQUEST_STATUS _IO('W', 1)
+
+/*
+ * IOCTL command to select the data reporting mode (output report 0x12).
+ * mode is one of the data report IDs 0x30-0x37, 0x3d or 0x3e (interleaved,
+ * which alternates 0x3e and 0x3f). With continuous set the remote reports at
+ * a steady 100 Hz; otherwise it only reports when its data changes.
+ */
+struct wii_report_mode {
+    __u8 mode;
+    __u8 continuous;
+};
+
+#define WIIMOTE_IOCTL_SET_REPORT_MODE _IOW('W', 2, struct wii_report_mode)
+
+/* IOCTL command to read the counters of this file's buffer since it was opened */
+struct wii_ring_stats {
+    __u64 enqueued;         /* records queued */
+    __u64 dropped;          /* new records refused because the buffer was full */
+    __u64 overwritten;      /* old records discarded under WII_DROP_OLDEST */
+    __u32 high_water;       /* most bytes ever queued at once */
+    __u32 size;             /* buffer size in bytes */
+};
+
+#define WIIMOTE_IOCTL_GET_RING_STATS _IOR('W', 3, struct wii_ring_stats)
+
+/*
+ * IOCTL command to choose what happens when a record arrives and this file's
+ * buffer is full. WII_DROP_OLDEST needs the fixed-size binary records, it is
+ * refused with -EINVAL in text mode.
+ */
+#define WII_DROP_NEWEST 0
+#define WII_DROP_OLDEST 1
+
+#define WIIMOTE_IOCTL_SET_DROP_POLICY _IOW('W', 4, __u32)
+
+/*
+ * IOCTL command to replace this file's buffer with one of the given size in bytes,
+ * between WII_RING_MIN_SIZE and WII_RING_MAX_SIZE and rounded up to a power
+ * of two. Records still queued are discarded. Fails with -EBUSY while the
+ * buffer is mapped.
+ */
+#define WII_RING_MIN_SIZE 1024
+#define WII_RING_MAX_SIZE (16 << 20)
+
+#define WIIMOTE_IOCTL_SET_RING_SIZE _IOW('W', 5, __u32)
+
+/* IOCTL command to set the four player LEDs (output report 0x11), a WII_LED_* mask */
+#define WII_LED_1   0x1
+#define WII_LED_2   0x2
+#define WII_LED_3   0x4
+#define WII_LED_4   0x8
+#define WII_LED_ALL 0xf
+
+#define WIIMOTE_IOCTL_SET_LEDS _IOW('W', 6, __u32)
+
+/* IOCTL command to switch the rumble motor on (non-zero) or off */
+#define WIIMOTE_IOCTL_SET_RUMBLE _IOW('W', 7, __u32)
+
+/*
+ * IOCTL command to read several binary records in one call, like recvmmsg().
+ * Waits until min_count records are queued (at least one, and no more than
+ * the buffer holds) or timeout_ms expires, then copies up to count records
+ * to buf and stores how many in returned; that can be fewer than min_count,
+ * or none, after a timeout. A negative timeout_ms waits indefinitely and 0
+ * (or O_NONBLOCK) does not wait at all. Records are struct wii_event, or
+ * struct wii_raw_report in WII_FORMAT_RAW. Fails with -EINVAL for text events
+ * and with -ENODEV once the remote is gone and nothing is left to read.
+ */
+struct wii_read_batch {
+    __u64 buf;              /* user pointer to count records */
+    __u32 count;
+    __u32 min_count;
+    __s32 timeout_ms;
+    __u32 returned;         /* written by the driver */
+};
+
+#define WIIMOTE_IOCTL_READ_BATCH _IOWR('W', 8, struct wii_read_batch)
+
+/*
+ * IOCTL command to read the driver's last known state of the remote without
+ * talking to it. age_ns is the time since the last status report (battery
+ * and flags), U64_MAX if none has arrived yet; the other fields are always
+ * current. When the status report is older than max_age_ms the driver also
+ * queues a status request, unless it queued one within max_age_ms already,
+ * and sets refreshing; the answer shows up in later snapshots. max_age_ms 0
+ * never refreshes. ir_state follows WIIMOTE_IOCTL_IR_INIT.
+ */
+#define WII_STATUS_F_BATTERY_LOW 0x01
+#define WII_STATUS_F_EXT         0x02   /* an extension controller is plugged in */
+#define WII_STATUS_F_SPEAKER     0x04
+#define WII_STATUS_F_IR          0x08
+
+struct wii_status {
+    __u64 age_ns;
+    __u16 buttons;          /* WII_BTN_* from the latest input report */
+    __u8  battery;          /* raw level from the last status report */
+    __u8  flags;            /* WII_STATUS_F_* from the last status report */
+    __u8  leds;             /* WII_LED_* last sent */
+    __u8  report_mode;      /* data reporting mode last sent */
+    __u8  continuous;
+    __u8  ir_state;         /* WII_IR_STATE_* */
+};
+
+struct wii_status_query {
+    __u32 max_age_ms;
+    __u32 refreshing;       /* written by the driver: a status request was queued */
+    struct wii_status status;
+};
+
+#define WIIMOTE_IOCTL_GET_STATUS _IOWR('W', 9, struct wii_status_query)
+
+/*
+ * IOCTL command to read the accelerometer calibration, which the driver reads
+ * from the remote once when it connects. Until the answer arrives (source
+ * WII_CALIB_PENDING) or when it could not be read (WII_CALIB_NOMINAL), typical
+ * values are returned. Values are raw 10-bit readings at rest and at +1 g.
+ */
+#define WII_CALIB_NOMINAL 0
+#define WII_CALIB_EEPROM  1
+#define WII_CALIB_PENDING 2
+
+struct wii_calibration {
+    __u16 zero[3];
+    __u16 one_g[3];
+    __u8  source;           /* WII_CALIB_* */
+    __u8  reserved[3];
+};
+
+#define WIIMOTE_IOCTL_GET_CALIBRATION _IOR('W', 10, struct wii_calibration)
+
+/*
+ * IOCTL command to choose what this file receives: decoded events (the
+ * default) or every input report exactly as the remote sent it, as struct
+ * wii_raw_report records, without any decoding or filtering. Records still
+ * queued are discarded; fails with -EBUSY while the buffer is mapped.
+ */
+#define WII_FORMAT_EVENTS 0
+#define WII_FORMAT_RAW    1
+
+#define WII_RAW_MAX_LEN 22
+
+struct wii_raw_report {
+    __u64 timestamp_ns;             /* CLOCK_MONOTONIC time the report arrived */
+    __u8  len;                      /* valid bytes in data */
+    __u8  data[WII_RAW_MAX_LEN];    /* report ID first */
+    __u8  reserved;
+} __attribute__((packed));
+
+#define WIIMOTE_IOCTL_SET_FORMAT _IOW('W', 11, __u32)
+
+/*
+ * IOCTL command to set up the IR camera, or turn it off with
+ * WII_IR_CAMERA_OFF. The whole register sequence is queued at once and the
+ * call returns; the driver follows the remote's acknowledgements, and
+ * ir_state in struct wii_status goes from WII_IR_STATE_BUSY to READY, or to
+ * FAILED on an error or when an acknowledgement does not arrive in time.
+ * Fails with -EBUSY while a sequence is still running, or while reports of
+ * one that failed have not gone out yet. The camera mode has to match the
+ * data reporting mode: basic for 0x36 and 0x37, extended for 0x33, full for
+ * 0x3e. sensitivity is 1 (least) to 5, 0 for the default of 3.
+ */
+#define WII_IR_CAMERA_OFF       0
+#define WII_IR_CAMERA_BASIC     1
+#define WII_IR_CAMERA_EXTENDED  3
+#define WII_IR_CAMERA_FULL      5
+
+#define WII_IR_STATE_OFF    0
+#define WII_IR_STATE_BUSY   1
+#define WII_IR_STATE_READY  2
+#define WII_IR_STATE_FAILED 3
+
+struct wii_ir_config {
+    __u8 mode;              /* WII_IR_CAMERA_* */
+    __u8 sensitivity;
+    __u8 reserved[2];
+};
+
+#define WIIMOTE_IOCTL_IR_INIT _IOW('W', 12, struct wii_ir_config)
+
+/*
+ * IOCTL command to capture every input report of the remote, as struct
+ * wii_raw_report records, into a ring of the given size in bytes (rounded up
+ * to a power of two, WII_RING_MIN_SIZE to WII_CAPTURE_MAX_SIZE) that is read
+ * from debugfs, wii_remote/wii_remoteN. Capturing costs the receive path one
+ * 32-byte copy per report and does not depend on any file staying open; a
+ * running capture also keeps the power_save module parameter from cutting
+ * the remote down to button reports while nothing else is open. When the
+ * ring is full the oldest records are overwritten, so it always holds
+ * the latest history. 0 stops capturing and discards what was not read; a
+ * new size starts over with an empty ring. Needs CAP_SYS_ADMIN. The records
+ * are the capture format of bench/wii-bench.
+ */
+#define WII_CAPTURE_MAX_SIZE (64 << 20)
+
+#define WIIMOTE_IOCTL_SET_CAPTURE _IOW('W', 13, __u32)
+
+/*
+ * IOCTL command to play a rumble and LED pattern: count steps, each showing
+ * leds (WII_LED_*) with the motor on or off for duration_ms (at least 1).
+ * The pattern plays through repeat times, or endlessly for 0, and the remote
+ * then stays in the state of the last step. A kernel timer keeps the timing
+ * against the time the pattern started, so it does not drift.
+ *
+ * Only changes are sent. A step that repeats the state before it costs
+ * nothing, and an LED change carries the rumble bit along in the same report.
+ * At most one new state goes out per 10 ms, the input report rate; a shorter
+ * step is skipped when its turn falls between two updates. Output traffic
+ * therefore stays bounded however fine the pattern or however often it is
+ * replaced.
+ *
+ * A new pattern replaces the one playing, and count 0 just stops it.
+ * WIIMOTE_IOCTL_SET_LEDS and WIIMOTE_IOCTL_SET_RUMBLE stop it too. Fails with
+ * -EINVAL for more than WII_PATTERN_MAX_STEPS steps or a bad step, and with
+ * -ENODEV once the remote is gone.
+ */
+#define WII_PATTERN_MAX_STEPS 64
+
+struct wii_pattern_step {
+    __u8  leds;             /* WII_LED_* */
+    __u8  rumble;           /* non-zero to run the motor */
+    __u16 duration_ms;
+};
+
+struct wii_pattern {
+    __u64 steps;            /* user pointer to count struct wii_pattern_step */
+    __u32 count;
+    __u32 repeat;           /* passes to play, 0 to loop until replaced */
+};
+
+#define WIIMOTE_IOCTL_SET_PATTERN _IOW('W', 14, struct wii_pattern)
+
+/*
+ * Binary event records.
+ *
+ * Every open file of /dev/wii_remoteN has its own buffer and receives every
+ * event from the time it was opened, so several processes can read the same
+ * remote without stealing each other's events. The ring size, drop policy and
+ * counters ioctls apply to the file they are issued on.
+ *
+ * By default every report is delivered as one struct wii_event. Records are
+ * fixed size and back to back in the stream; check version before trusting
+ * the layout. The text format is still available with the text_events module
+ * parameter.
+ *
+ * Versions:
+ *   1 - buttons, accelerometer, IR, battery, timestamp
+ *   2 - extension bytes; button bits follow the remote's own layout
+ *   3 - changed mask of the buttons pressed or released by this event
+ *   4 - status flags; battery comes from byte 6 of the status report, where
+ *       earlier versions reported the second button byte
+ *   5 - derived data (calibrated acceleration, tilt, IR pointer); the record
+ *       grew from 72 to 88 bytes
+ *   6 - remote, the N of /dev/wii_remoteN, in what was reserved3
+ */
+#define WII_EVENT_VERSION 6
+
+/* Core button mask, bytes 1-2 of every input report read little-endian */
+#define WII_BTN_DPAD_LEFT   0x0001
+#define WII_BTN_DPAD_RIGHT  0x0002
+#define WII_BTN_DPAD_DOWN   0x0004
+#define WII_BTN_DPAD_UP     0x0008
+#define WII_BTN_PLUS        0x0010
+#define WII_BTN_TWO         0x0100
+#define WII_BTN_ONE         0x0200
+#define WII_BTN_B           0x0400
+#define WII_BTN_A           0x0800
+#define WII_BTN_MINUS       0x1000
+#define WII_BTN_HOME        0x8000
+
+/* wii_event.flags: which optional fields hold data for this record */
+#define WII_EVENT_F_ACCEL   0x0001
+#define WII_EVENT_F_IR      0x0002
+#define WII_EVENT_F_BATTERY 0x0004
+#define WII_EVENT_F_EXT     0x0008
+#define WII_EVENT_F_BUTTONS 0x0010
+#define WII_EVENT_F_TILT    0x0020  /* accel_mg, pitch and roll are valid */
+#define WII_EVENT_F_POINTER 0x0040  /* pointer_x and pointer_y are valid */
+
+#define WII_IR_DOTS 4
+#define WII_EXT_MAX_LEN 21
+
+struct wii_ir_dot {
+    __u16 x;            /* 0..1023, 0x3ff when the dot is not tracked */
+    __u16 y;            /* 0..767, 0x3ff when the dot is not tracked */
+    __u8  size;         /* 0..15, only reported in extended/full IR mode */
+    __u8  reserved;
+} __attribute__((packed));
+
+struct wii_event {
+    __u64 timestamp_ns;             /* CLOCK_MONOTONIC time the report arrived */
+    __u8  version;                  /* WII_EVENT_VERSION */
+    __u8  report_id;
+    __u16 flags;                    /* WII_EVENT_F_* */
+    __u16 buttons;                  /* WII_BTN_* */
+    __u16 accel[3];                 /* raw 10-bit x, y, z */
+    struct wii_ir_dot ir[WII_IR_DOTS];
+    __u8  battery;
+    __u8  status;                   /* WII_STATUS_F_*, with WII_EVENT_F_BATTERY */
+    __u16 changed;                  /* buttons that differ from the previous event */
+    __u8  ext_len;                  /* valid bytes in ext */
+    __u8  ext[WII_EXT_MAX_LEN];     /* extension controller bytes, as received */
+    __u8  reserved2[2];
+
+    /*
+     * Derived data, filled in only with the derived_data module parameter.
+     * Pitch is positive with the pointing end up and roll positive when
+     * turned clockwise as seen from behind; both are in hundredths of a
+     * degree. The pointer is the midpoint of the first two tracked IR dots,
+     * mirrored so that it moves the way the remote points: -32767..32767
+     * from left to right and top to bottom, 0 at the centre. Roll is not
+     * compensated for.
+     */
+    __s16 accel_mg[3];              /* calibrated x, y, z in thousandths of g */
+    __s16 pitch;                    /* -9000..9000 */
+    __s16 roll;                     /* -18000..18000 */
+    __s16 pointer_x;
+    __s16 pointer_y;
+    __u16 remote;                   /* N of /dev/wii_remoteN that sent it */
+} __attribute__((packed));
+
+/*
+ * Aggregate stream.
+ *
+ * /dev/wii_remote_all carries the events of every connected remote as one
+ * stream of struct wii_event records, told apart by remote, so a single
+ * poll() or epoll wakeup serves all of them. One file can have it open at a
+ * time; a second open fails with -EBUSY.
+ *
+ * While it is open every remote also queues its events into a buffer of its
+ * own, ring_size bytes that drop the newest event when full, and read()
+ * merges them: each record returned is the oldest event, by timestamp_ns, at
+ * the front of any remote's buffer. The stream is therefore in arrival order
+ * as far as the events had been decoded when the read ran. Remotes that
+ * connect while the file is open join the stream; the events a remote queued
+ * before disconnecting are still delivered. Blocking and O_NONBLOCK behave as
+ * on /dev/wii_remoteN, except that reads never fail with -ENODEV. Only read()
+ * and poll() are supported, and the ioctls go to each remote's own node. Not
+ * available with text events.
+ */
+
+/*
+ * Shared event ring.
+ *
+ * mmap() of /dev/wii_remote maps a struct wii_ring_header followed, at
+ * data_offset bytes from the start of the mapping, by size bytes of ring
+ * data holding the same stream that read() returns. head and tail count
+ * bytes and wrap naturally; the readable bytes are [tail, head), each
+ * position masked with (size - 1). Records are always written whole.
+ *
+ * To consume: load head with acquire semantics, process records up to it,
+ * then store the new tail with release semantics. Use poll() to sleep when
+ * head == tail. A ring has one consumer, so do not mix read() and mmap on
+ * the same open file; open the device again for a second consumer.
+ *
+ * When flags has WII_RING_F_OVERWRITE the driver may advance tail itself to
+ * discard the oldest records. Load tail before copying records out and then
+ * update it with a compare-and-swap from that value; if the swap fails the
+ * copied records may have been overwritten, so start again from the new tail.
+ */
+#define WII_RING_VERSION 2
+
+#define WII_RING_F_OVERWRITE 0x1
+
+struct wii_ring_header {
+    __u32 version;          /* WII_RING_VERSION */
+    __u32 data_offset;      /* page-aligned offset of the ring data */
+    __u32 size;             /* bytes of ring data, a power of two */
+    __u32 record_size;      /* sizeof(struct wii_event), or 0 for text */
+    __u32 flags;            /* WII_RING_F_* */
+    __u32 reserved0[11];
+    __u32 head;             /* written by the driver only */
+    __u32 reserved1[15];
+    __u32 tail;             /* written by the consumer (and the driver, see above) */
+    __u32 reserved2[15];
+};
+
+#endif /* WII_REMOTE_H */